@@ -1,7 +1,13 @@
 #pragma once
 
+#include <atomic>
+#include <cstdlib>
+
 #include "utils.h"
 #include "problem_instance.h"
+#include "local_search.h"
+#include "two_level_list.h"
+#include "tree_tour.h"
 
 
 struct RouteIterator {
@@ -20,11 +26,56 @@ struct RouteIterator {
 };
 
 
+// Range of positions [first_, last_] in a route
+struct PositionRange {
+    uint32_t first_;
+    uint32_t last_;
+};
+
+
+/*
+ * Returns the change of the tour's cost resulting from moving v so that it is
+ * placed directly after u, assuming that v does not follow u already.
+ * Requires O(1) distance computations.
+ */
+template<typename Tour>
+double get_relocation_cost_delta(const Tour &tour, uint32_t u, uint32_t v,
+                                 const ProblemInstance &problem) {
+    const auto v_pred = tour.get_pred(v);
+    const auto v_succ = tour.get_succ(v);
+    const auto u_succ = tour.get_succ(u);  // Remains the same after removing v
+    return problem.get_distance(v_pred, v_succ)
+         - problem.get_distance(v_pred, v)
+         - problem.get_distance(v, v_succ)
+         + problem.get_distance(u, v)
+         + problem.get_distance(v, u_succ)
+         - problem.get_distance(u, u_succ);
+}
+
+
 struct Solution {
     std::vector<uint32_t> route_;
     double cost_ = std::numeric_limits<double>::max();
     std::vector<uint32_t> node_indices_;
 
+    /*
+     * Undo log which allows update(const Solution *) to copy only the parts
+     * of the route that differ from the other solution. Each update gives the
+     * solution a new (unique) version. changes_ holds the ranges of positions
+     * modified since the last update and update_changes_ the ranges copied
+     * by the last update. The logs are not valid if the route was modified
+     * directly, e.g. by writing a new route into route_.
+     */
+    static constexpr uint32_t MaxLoggedChanges = 64;
+
+    std::vector<PositionRange> changes_;
+    std::vector<PositionRange> update_changes_;
+    bool changes_valid_ = false;
+    bool update_changes_valid_ = false;
+    uint64_t version_ = get_next_version();
+    uint64_t prev_version_ = 0;    // Version before the last update
+    uint64_t source_version_ = 0;  // Version of the solution copied by the last update
+
     Solution() = default;
 
     Solution(const std::vector<uint32_t> &route, double cost)
@@ -32,26 +83,117 @@ struct Solution {
           cost_(cost),
           node_indices_(route.size(), 0) {
         update_node_indices();
+        changes_valid_ = true;
     }
 
     void update(const std::vector<uint32_t> &route, double cost) {
         route_ = route;
         cost_ = cost;
         update_node_indices();
+        start_new_version(0);
+        update_changes_valid_ = false;
     }
 
+    /*
+     * Makes this a copy of the other solution. If both solutions were
+     * recently synchronized (one was updated from the other), only the
+     * positions recorded in the undo logs are copied, which takes time
+     * proportional to the number of changes instead of O(n).
+     */
     void update(const Solution *other) {
-        route_ = other->route_;
+        const auto &other_route = other->route_;
+        update_changes_.clear();
+        bool copy_all = !changes_valid_ || !other->changes_valid_
+                     || route_.size() != other_route.size();
+        if (!copy_all) {
+            append_changes(changes_);
+            append_changes(other->changes_);
+            if (source_version_ == other->version_
+                    || version_ == other->source_version_) {
+                // Nothing else to copy
+            } else if (source_version_ == other->prev_version_
+                    && other->update_changes_valid_) {
+                append_changes(other->update_changes_);
+            } else {
+                copy_all = true;
+            }
+        }
+        if (!copy_all) {
+            size_t total_length = 0;
+            for (auto [first, last] : update_changes_) {
+                total_length += last - first + 1;
+            }
+            copy_all = total_length >= route_.size() / 2;
+        }
+
+        if (copy_all) {
+            route_ = other_route;
+            update_node_indices();
+        } else {
+            for (auto [first, last] : update_changes_) {
+                for (auto i = first; i <= last; ++i) {
+                    route_[i] = other_route[i];
+                    node_indices_[route_[i]] = i;
+                }
+            }
+        }
+        assert(route_ == other_route);
         cost_ = other->cost_;
-        update_node_indices();
+        start_new_version(other->version_);
+        update_changes_valid_ = !copy_all;
     }
 
+    // Has to be called after the route_ was modified directly, invalidates
+    // the undo log
     void update_node_indices() {
         for (size_t i = 0; i < route_.size(); ++i) {
             node_indices_[route_[i]] = static_cast<uint32_t>(i);
         }
+        changes_valid_ = false;
+    }
+
+    // Records that the positions between i and j (inclusive, in any order)
+    // were modified
+    void record_change(uint32_t i, uint32_t j) {
+        if (!changes_valid_) {
+            return ;
+        }
+        if (i > j) {
+            std::swap(i, j);
+        }
+        if (!changes_.empty()) {  // Try to extend the last range
+            auto &last = changes_.back();
+            if (i <= last.last_ + 1 && last.first_ <= j + 1) {
+                last.first_ = std::min(last.first_, i);
+                last.last_ = std::max(last.last_, j);
+                return ;
+            }
+        }
+        if (changes_.size() < MaxLoggedChanges) {
+            changes_.push_back({ i, j });
+        } else {
+            changes_valid_ = false;
+        }
+    }
+
+    void append_changes(const std::vector<PositionRange> &changes) {
+        update_changes_.insert(update_changes_.end(), changes.begin(), changes.end());
+    }
+
+    void start_new_version(uint64_t source_version) {
+        prev_version_ = version_;
+        version_ = get_next_version();
+        source_version_ = source_version;
+        changes_.clear();
+        changes_valid_ = true;
+    }
+
+    static uint64_t get_next_version() {
+        static std::atomic<uint64_t> next_version { 1 };
+        return next_version++;
     }
 
+    // Does not record the change, this is left to the callers
     void swap_(uint32_t i, uint32_t j) {
         std::swap(node_indices_[route_[i]], node_indices_[route_[j]]);
         std::swap(route_[i], route_[j]);
@@ -60,6 +202,7 @@ struct Solution {
     void relocate(uint32_t u, uint32_t v) {
         // place v after u
         uint32_t i = node_indices_[u], j = node_indices_[v];
+        record_change(i, j);
         if (j < i) {
             swap_(i, j);
             while (j < i - 1) {
@@ -74,26 +217,59 @@ struct Solution {
         }
     }
 
-    void swap_with_next(uint32_t i, const ProblemInstance& problem) {
-        // swap route[i] with route[i + 1]
-        assert(i + 1 < route_.size());
-        uint32_t u = route_[i], v = route_[i + 1];
-        cost_ -= problem.get_distance(get_pred(u), u) + problem.get_distance(v, get_succ(v));
-        std::swap(node_indices_[u], node_indices_[v]);
-        std::swap(route_[i], route_[i + 1]);
-        cost_ += problem.get_distance(get_pred(u), u) + problem.get_distance(v, get_succ(v));
+    // Places v after u and updates the cost of the route
+    void relocate(uint32_t u, uint32_t v, const ProblemInstance& problem) {
+        if (get_succ(u) != v) {
+            cost_ += get_relocation_cost_delta(*this, u, v, problem);
+        }
+        relocate(u, v);
     }
 
-    void relocate_rgaco(uint32_t u, uint32_t v, const ProblemInstance& problem) {
-        // place v after u
-        uint32_t i = node_indices_[u], j = node_indices_[v];
-        while (j < i) {
-            swap_with_next(j, problem);
-            ++j;
+    // Returns true if b lies on the path going from a to c (in the order of
+    // the route), including the endpoints
+    [[nodiscard]] bool between(uint32_t a, uint32_t b, uint32_t c) const {
+        const auto i = node_indices_[a];
+        const auto j = node_indices_[b];
+        const auto k = node_indices_[c];
+        return (i <= k) ? (i <= j && j <= k) : (i <= j || j <= k);
+    }
+
+    /*
+     * Performs a 2-opt move which replaces edges (t1, t2) and (t3, t4) with
+     * (t1, t3) and (t2, t4). It is assumed that t2 follows t1 and t4 follows
+     * t3 in the same direction of traversal -- it does not matter if it
+     * agrees with the order of the nodes in the route.
+     */
+    void flip(uint32_t t1, uint32_t t2, uint32_t t3, uint32_t /*t4*/) {
+        if (get_succ(t1) == t2) {
+            reverse(t2, t3);
+        } else {
+            reverse(t3, t2);
         }
-        while (j > i + 1) {
-            swap_with_next(j - 1, problem);
-            --j;
+    }
+
+    /*
+     * Reverses the part of the route starting at first_node and ending at
+     * last_node (inclusive), in the order in which the nodes are stored in the
+     * route. If the part is long, the remaining part is reversed instead,
+     * which results in an equivalent (undirected) route.
+     */
+    void reverse(uint32_t first_node, uint32_t last_node) {
+        const auto first = static_cast<int32_t>(node_indices_[first_node]);
+        const auto last = static_cast<int32_t>(node_indices_[last_node]);
+
+        if (first <= last) {
+            flip_route_section(route_, node_indices_, first, last + 1);
+        } else {
+            flip_route_section(route_, node_indices_, last + 1, first);
+        }
+        // flip_route_section can reverse the remaining (wrapping) part of the
+        // route instead, so the change is recorded only for a short section
+        const auto length = std::abs(last - first) + 1;
+        if (2 * length <= static_cast<int32_t>(route_.size())) {
+            record_change(static_cast<uint32_t>(first), static_cast<uint32_t>(last));
+        } else {
+            changes_valid_ = false;
         }
     }
 
@@ -120,7 +296,12 @@ struct Solution {
 
 
 struct Ant : public Solution {
+    // The unvisited nodes (in no particular order) and the positions of the
+    // nodes in unvisited_, so that a node can be removed in O(1) time
     std::vector<uint32_t> unvisited_;
+    std::vector<uint32_t> unvisited_positions_;
+    // Nodes visited by mark_visited, i.e. these are not on the route
+    std::vector<uint32_t> marked_nodes_;
     Bitmask  visited_bitmask_;
     uint32_t dimension_ = 0;
     uint32_t visited_count_ = 0;
@@ -130,7 +311,6 @@ struct Ant : public Solution {
 
     Ant(const std::vector<uint32_t> &route, double cost)
         : Solution(route, cost),
-          unvisited_(route.size(), static_cast<uint32_t >(route.size())),
           dimension_(static_cast<uint32_t>(route.size())),
           visited_count_(static_cast<uint32_t>(route.size())) {
     }
@@ -140,10 +320,13 @@ struct Ant : public Solution {
         visited_count_ = 0;
 
         route_.resize(dimension);
-        node_indices_.reserve(dimension);
+        node_indices_.resize(dimension);
 
         unvisited_.resize(dimension);
         std::iota(unvisited_.begin(), unvisited_.end(), 0);
+        unvisited_positions_.resize(dimension);
+        std::iota(unvisited_positions_.begin(), unvisited_positions_.end(), 0);
+        marked_nodes_.clear();
 
         visited_bitmask_.resize(dimension);
         visited_bitmask_.clear();
@@ -152,8 +335,29 @@ struct Ant : public Solution {
     void visit(uint32_t node) {
         assert(!is_visited(node));
 
+        record_change(visited_count_, visited_count_);
         route_[visited_count_++] = node;
+        set_visited(node);
+    }
+
+    // Marks the node as visited without adding it to the route, does nothing
+    // if the node is already visited
+    void mark_visited(uint32_t node) {
+        if (!is_visited(node)) {
+            set_visited(node);
+            marked_nodes_.push_back(node);
+        }
+    }
+
+    // Assumes that the node is not visited yet
+    void set_visited(uint32_t node) {
         visited_bitmask_.set_bit(node);
+
+        const auto pos = unvisited_positions_[node];
+        const auto last = unvisited_.back();
+        unvisited_[pos] = last;
+        unvisited_positions_[last] = pos;
+        unvisited_.pop_back();
     }
 
     void validate(const ProblemInstance& problem) {
@@ -184,34 +388,75 @@ struct Ant : public Solution {
     }
 
     [[nodiscard]] uint32_t get_unvisited_count() const {
-        return dimension_ - visited_count_;
-    }
-
-    const std::vector<uint32_t> &get_unvisited_nodes() {
-        // Filter out visited nodes from unvisited_ list that
-        // now can be invalid
-        //
-        // This has linear complexity but should not be a problem
-        // if this method is not called very often.
-        size_t n = unvisited_.size();
-        size_t j = 0;
-        for (size_t i = 0; i < n; ++i) {
-            auto node = unvisited_[i];
-            if (!is_visited(node)) {
-                unvisited_[j++] = node;
-            }
-        }
-        assert(j == get_unvisited_count());
-        unvisited_.resize(j);
+        return static_cast<uint32_t>(unvisited_.size());
+    }
+
+    [[nodiscard]] const std::vector<uint32_t> &get_unvisited_nodes() const {
         return unvisited_;
     }
 };
 
 
-struct DoubleLinkedListSolution {
+/*
+ * Solution stored as a two-level doubly-linked list, so that the local search
+ * can reverse parts of the route in O(sqrt(n)) time. The cost is not updated
+ * by the list operations.
+ */
+struct DoubleLinkedListSolution : public TwoLevelList {
+    double cost_ = std::numeric_limits<double>::max();
+
+    DoubleLinkedListSolution() = default;
+
+    DoubleLinkedListSolution(const std::vector<uint32_t> &route, double cost)
+        : TwoLevelList(route),
+          cost_(cost) {
+    }
+
+    void update(const std::vector<uint32_t> &route, double cost) {
+        init(route);
+        cost_ = cost;
+    }
 
+    void update(const Solution *other) {
+        update(other->route_, other->cost_);
+    }
 };
 
+/*
+ * Solution stored as a balanced binary tree (see TreeTour). Similarly to
+ * Solution it allows to relocate nodes and query their neighbors, but all of
+ * the operations, including 2-opt moves, take O(log(n)) time.
+ */
+struct TreeSolution : public TreeTour {
+    double cost_ = std::numeric_limits<double>::max();
+
+    TreeSolution() = default;
+
+    TreeSolution(const std::vector<uint32_t> &route, double cost)
+        : TreeTour(route),
+          cost_(cost) {
+    }
+
+    void update(const std::vector<uint32_t> &route, double cost) {
+        init(route);
+        cost_ = cost;
+    }
+
+    void update(const Solution *other) {
+        update(other->route_, other->cost_);
+    }
+
+    // Places v after u and updates the cost, similarly to Solution::relocate
+    void relocate(uint32_t u, uint32_t v, const ProblemInstance& problem) {
+        if (get_succ(u) == v) {
+            return ;
+        }
+        cost_ += get_relocation_cost_delta(*this, u, v, problem);
+        TreeTour::relocate(u, v);
+    }
+};
+
+
 struct DoubleLinkedListAnt {
 
 };
\ No newline at end of file
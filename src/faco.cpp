@@ -22,9 +22,13 @@
 #include <memory>
 #include <functional>
 #include <filesystem>
+#include <optional>
+#include <sstream>
 #include <omp.h>
 
 #include "problem_instance.h"
+#include "instance_cache.h"
+#include "selection.h"
 #include "ant.h"
 #include "pheromone.h"
 #include "local_search.h"
@@ -50,10 +54,26 @@ struct HeuristicData {
     }
 
     [[nodiscard]] double get(uint32_t from, uint32_t to) const {
-        auto d = problem_.get_distance(from, to);
+        return get_for_distance(problem_.get_distance(from, to));
+    }
+
+    [[nodiscard]] double get_for_distance(double d) const {
         return (d > 0) ? 1. / std::pow(d, beta_) : 1;
     }
 
+    // Fills the cache with the values for the first cl_size nearest
+    // neighbors of every node, using the precomputed distances
+    template<typename Value_t>
+    void fill_cand_list_cache(uint32_t cl_size, std::vector<Value_t> &cache) const {
+        const auto dimension = problem_.dimension_;
+        cache.resize(cl_size * dimension);
+        for (uint32_t node = 0 ; node < dimension ; ++node) {
+            const auto *nn_distances = problem_.get_nn_distances(node);
+            std::transform(nn_distances, nn_distances + cl_size, cache.begin() + node * cl_size,
+                           [this](double d) { return static_cast<Value_t>(get_for_distance(d)); });
+        }
+    }
+
     [[nodiscard]] uint32_t find_node_with_max_value(uint32_t from, const std::vector<uint32_t> &nodes) const {
         assert(beta_ > 0);
 
@@ -61,7 +81,8 @@ struct HeuristicData {
         auto min_dist = std::numeric_limits<double>::max();
         for (auto node : nodes) {
             auto dist = problem_.get_distance(from, node);
-            if (dist < min_dist) {
+            // The nodes are not ordered, so the ties are broken by the index
+            if (dist < min_dist || (dist == min_dist && node < result)) {
                 min_dist = dist;
                 result = node;
             }
@@ -71,11 +92,73 @@ struct HeuristicData {
 };
 
 
+/*
+ * Finds the unvisited node nearest to a given node using a view of the
+ * instance's kd-tree, so that it can be used by many threads at once -- every
+ * thread should have its own object. The view is updated lazily, i.e. the
+ * nodes visited since the previous query are deleted from it only when a
+ * query is made. Until the deletions would cost more than the scans of the
+ * unvisited nodes made since the last update (or if there is no kd-tree), the
+ * unvisited nodes are scanned instead.
+ *
+ * Has to be reset before the construction of every solution.
+ */
+struct NearestUnvisitedSearch {
+    std::unique_ptr<KDTreeView> view_ = nullptr;
+    uint32_t synced_route_ = 0;   // # of route's nodes deleted from view_
+    uint32_t synced_marked_ = 0;  // # of marked nodes deleted from view_
+    uint64_t scanned_ = 0;        // # of nodes scanned since view_ was updated
+
+    explicit NearestUnvisitedSearch(const ProblemInstance &problem) {
+        if (problem.kdtree_ != nullptr) {
+            view_ = std::make_unique<KDTreeView>(*problem.kdtree_);
+        }
+    }
+
+    void reset() {
+        if (view_ != nullptr) {
+            view_->reset();
+        }
+        synced_route_ = synced_marked_ = 0;
+        scanned_ = 0;
+    }
+
+    uint32_t find(const HeuristicData &heuristic, const Ant &ant, uint32_t from) {
+        assert(ant.get_unvisited_count() > 0);
+        const auto marked_count = static_cast<uint32_t>(ant.marked_nodes_.size());
+        const auto pending = (ant.visited_count_ - synced_route_) + (marked_count - synced_marked_);
+        // Deleting a node from the view takes O(log(n)) time (cheap steps,
+        // about 4 distance computations), so the view is updated only when
+        // the scans made since the last update have cost about as much as the
+        // pending deletions -- the total time is then at most about twice the
+        // optimum, and the view never stays out of date for good
+        scanned_ += ant.get_unvisited_count();
+        if (view_ == nullptr || size_t{pending} * 4 > scanned_) {
+            return heuristic.find_node_with_max_value(from, ant.get_unvisited_nodes());
+        }
+        scanned_ = 0;
+        for (; synced_route_ < ant.visited_count_; ++synced_route_) {
+            view_->delete_point(ant.route_[synced_route_]);
+        }
+        for (; synced_marked_ < marked_count; ++synced_marked_) {
+            view_->delete_point(ant.marked_nodes_[synced_marked_]);
+        }
+        const auto &problem = heuristic.problem_;
+        const auto node = view_->nn(from, [&](uint32_t a, uint32_t b) {
+            return problem.get_distance(a, b);
+        });
+        assert(node != KDTreeView::Sentinel && !ant.is_visited(node));
+        return node;
+    }
+};
+
+
 uint32_t select_max_product_node(
         uint32_t current_node,
         Ant &ant,
         const MatrixPheromone &pheromone,
-        const HeuristicData &heuristic) {
+        const HeuristicData &heuristic,
+        NearestUnvisitedSearch &/*nearest_unvisited*/) {
 
     const auto unvisited_count = ant.get_unvisited_count();
     assert( unvisited_count > 0 );
@@ -99,21 +182,72 @@ uint32_t select_max_product_node(
 }
 
 
+template<typename Trail_t>
 uint32_t select_max_product_node(
         uint32_t current_node,
         Ant &ant,
-        const CandListPheromone &/*pheromone*/,
-        const HeuristicData &heuristic) {
+        const CandListPheromone<Trail_t> &/*pheromone*/,
+        const HeuristicData &heuristic,
+        NearestUnvisitedSearch &nearest_unvisited) {
 
     assert( ant.get_unvisited_count() > 0 );
     // We are assuming that all nodes on the cand list of the current_node
     // have been visited and thus we do not need to look for pheromone values
     // as all the other edges have the same - default - value
-    return heuristic.find_node_with_max_value(current_node, ant.get_unvisited_nodes());
+    return nearest_unvisited.find(heuristic, ant, current_node);
 }
 
 static const uint32_t MaxCandListSize = 32;
 
+/*
+ * Precision policies define how the pheromone trails (trail_t), the heuristic
+ * values (heuristic_t) and the products of both (product_t) used by the ants
+ * are stored. Smaller types allow more rows of the candidate lists to fit in
+ * the cache. The policy is selected with --precision.
+ */
+struct DoublePrecision {
+    using trail_t = double;
+    using heuristic_t = double;
+    using product_t = double;
+
+    static void store_products(const double *products, uint32_t count, product_t *out) {
+        std::copy(products, products + count, out);
+    }
+};
+
+struct FloatPrecision {
+    using trail_t = float;
+    using heuristic_t = float;
+    using product_t = float;
+
+    static void store_products(const double *products, uint32_t count, product_t *out) {
+        for (uint32_t i = 0; i < count; ++i) {
+            out[i] = static_cast<float>(products[i]);
+        }
+    }
+};
+
+/*
+ * The products are quantized to 16 bits relative to the max. product in the
+ * row. This does not change the selection probabilities (apart from the
+ * rounding) as these depend only on the ratios of the products in a row.
+ */
+struct Quantized16Precision {
+    using trail_t = float;
+    using heuristic_t = float;
+    using product_t = uint16_t;
+
+    static void store_products(const double *products, uint32_t count, product_t *out) {
+        const auto max_product = *std::max_element(products, products + count);
+        const auto scale = (max_product > 0) ? UINT16_MAX / max_product : 0.;
+        for (uint32_t i = 0; i < count; ++i) {
+            const auto q = static_cast<uint16_t>(std::lround(products[i] * scale));
+            // Nonzero products should not become zero, i.e. forbidden
+            out[i] = (q == 0 && products[i] > 0) ? 1 : q;
+        }
+    }
+};
+
 struct Limits {
     double min_ = 0;
     double max_ = 0;
@@ -176,157 +310,108 @@ typedef Limits (*calc_trail_limits_fn_t)(uint32_t dimension,
                          double solution_cost);
 
 
-template<typename Pheromone_t>
-uint32_t select_next_node(const Pheromone_t &pheromone,
+/*
+ * Selects the next node to move to from current_node. The nodes on the
+ * candidates list are selected using the given rule (Selection_t), see
+ * RouletteWheelSelection. If all of them were visited, the first unvisited
+ * node from the backup list is selected, or the node with the max. product
+ * of pheromone and heuristic if there is none (see NearestUnvisitedSearch).
+ */
+template<typename Selection_t, typename Pheromone_t, typename Product_t>
+uint32_t select_next_node(const Selection_t &selection,
+                          const Pheromone_t &pheromone,
                           const HeuristicData &heuristic,
                           const NodeList &nn_list,
-                          const vector<double> &nn_product_cache,
+                          const vector<Product_t> &nn_product_cache,
                           const NodeList &backup_nn_list,
-                          Ant &ant) {
+                          Ant &ant, uint32_t current_node,
+                          NearestUnvisitedSearch &nearest_unvisited) {
     assert(!ant.route_.empty());
-
-    const auto current_node = ant.get_current_node();
     assert(nn_list.size() <= ::MaxCandListSize);
 
-    // A list of the nearest unvisited neighbors of current_node, i.e. so
-    // called "candidates list", or "cl" in short
-    uint32_t cl[::MaxCandListSize];
-    uint32_t cl_size = 0;
-
     // In the MMAS the local pheromone evaporation is absent thus for each ant
     // the product of the pheromone trail and the heuristic will be the same
     // and we can pre-load it into nn_product_cache
-    auto nn_product_cache_it = nn_product_cache.begin()
-                             + static_cast<uint32_t>(current_node * nn_list.size());
-
-    double cl_product_prefix_sums[::MaxCandListSize];
-    double cl_products_sum = 0;
-    double max_prod = 0;
-    uint32_t max_node = current_node;
-    for (auto node : nn_list) {
-        uint32_t valid = 1 - ant.is_visited(node);
-        cl[cl_size] = node;
-        auto prod = *nn_product_cache_it * valid;
-        cl_products_sum += prod;
-        cl_product_prefix_sums[cl_size] = cl_products_sum;
-        cl_size += valid;
-        ++nn_product_cache_it;
-        if (max_prod < prod) {
-            max_prod = prod;
-            max_node = node;
-        }
-    }
-
-    uint32_t chosen_node = max_node;
-
-    if (cl_size > 1) { // Select from the closest nodes
-        // The following could be done using binary search in O(log(cl_size))
-        // time but should not matter for small values of cl_size
-        chosen_node = cl[cl_size - 1];
-        const auto r = get_rng().next_float() * cl_products_sum;
-        for (uint32_t i = 0; i < cl_size; ++i) {
-            if (r < cl_product_prefix_sums[i]) {
-                chosen_node = cl[i];
-                break;
-            }
-        }
-    } else if (cl_size == 0) { // Select from the rest of the unvisited nodes the one with the
-                               // maximum product of pheromone and heuristic
+    const auto cl_size = nn_list.size();
+    const auto products = nn_product_cache.data() + current_node * cl_size;
+
+    // Bit i is set if the i-th node on the candidates list ("cl" in short)
+    // is not visited
+    const auto unvisited_mask = get_unvisited_mask(nn_list.data(), cl_size,
+                                                   ant.visited_bitmask_.mask_.data());
+    const auto unvisited_count = __builtin_popcount(unvisited_mask);
+
+    uint32_t chosen_node = current_node;
+
+    if (unvisited_count > 1) { // Select from the closest nodes
+        chosen_node = nn_list[selection.select(current_node, products, cl_size, unvisited_mask)];
+    } else if (unvisited_count == 1) {
+        chosen_node = nn_list[__builtin_ctz(unvisited_mask)];
+    } else { // Select from the rest of the unvisited nodes the one with the
+             // maximum product of pheromone and heuristic
         for (auto node : backup_nn_list) {
             if (!ant.is_visited(node)) {
                 chosen_node = node;
                 break ;
             }
         }
-        if (chosen_node == max_node) {  // Still nothing selected
-            chosen_node = select_max_product_node(current_node, ant, pheromone, heuristic);
+        if (chosen_node == current_node) {  // Still nothing selected
+            chosen_node = select_max_product_node(current_node, ant, pheromone, heuristic,
+                                                  nearest_unvisited);
         }
     }
     assert(chosen_node != current_node);
     return chosen_node;
 }
 
-template<typename Pheromone_t>
-uint32_t select_next_node_(const Pheromone_t &pheromone,
-                          const HeuristicData &heuristic,
-                          const NodeList &nn_list,
-                          const vector<double> &nn_product_cache,
-                          const NodeList &backup_nn_list,
-                          Ant &ant, uint32_t current_node) {
-    assert(!ant.route_.empty());
-    assert(nn_list.size() <= ::MaxCandListSize);
-
-    // A list of the nearest unvisited neighbors of current_node, i.e. so
-    // called "candidates list", or "cl" in short
-    uint32_t cl[::MaxCandListSize];
-    uint32_t cl_size = 0;
-
-    // In the MMAS the local pheromone evaporation is absent thus for each ant
-    // the product of the pheromone trail and the heuristic will be the same
-    // and we can pre-load it into nn_product_cache
-    auto nn_product_cache_it = nn_product_cache.begin()
-                             + static_cast<uint32_t>(current_node * nn_list.size());
-
-    double cl_product_prefix_sums[::MaxCandListSize];
-    double cl_products_sum = 0;
-    double max_prod = 0;
-    uint32_t max_node = current_node;
-    for (auto node : nn_list) {
-        uint32_t valid = 1 - ant.is_visited(node);
-        cl[cl_size] = node;
-        auto prod = *nn_product_cache_it * valid;
-        cl_products_sum += prod;
-        cl_product_prefix_sums[cl_size] = cl_products_sum;
-        cl_size += valid;
-        ++nn_product_cache_it;
-        if (max_prod < prod) {
-            max_prod = prod;
-            max_node = node;
-        }
-    }
+/*
+ * Computes the products of the pheromone trails and the heuristic values for
+ * the edges connecting the nearest neighbors (up to cl_size). Only the rows
+ * (nodes) in which the trails could have changed since the last call are
+ * recomputed. If nn_cumulative_cache is not empty, the cumulative sums of the
+ * products in each row are stored in it. Has to be called by all threads of
+ * the parallel region once per iteration.
+ */
+template<typename Precision>
+void update_nn_product_cache(const ProblemInstance &problem,
+                             CandListPheromone<typename Precision::trail_t> &pheromone,
+                             const vector<typename Precision::heuristic_t> &cl_heuristic_cache,
+                             uint32_t cl_size,
+                             vector<typename Precision::product_t> &nn_product_cache,
+                             vector<product_sum_t<typename Precision::product_t>> &nn_cumulative_cache) {
+    assert(cl_size <= ::MaxCandListSize);
+    const auto dimension = problem.dimension_;
 
-    uint32_t chosen_node = max_node;
-
-    if (cl_size > 1) { // Select from the closest nodes
-        // The following could be done using binary search in O(log(cl_size))
-        // time but should not matter for small values of cl_size
-        chosen_node = cl[cl_size - 1];
-        const auto r = get_rng().next_float() * cl_products_sum;
-        for (uint32_t i = 0; i < cl_size; ++i) {
-            if (r < cl_product_prefix_sums[i]) {
-                chosen_node = cl[i];
-                break;
-            }
+    #pragma omp for schedule(static)
+    for (uint32_t node = 0 ; node < dimension ; ++node) {
+        if (!pheromone.is_row_changed(node)) {
+            continue ;
         }
-    } else if (cl_size == 0) { // Select from the rest of the unvisited nodes the one with the
-                               // maximum product of pheromone and heuristic
-        for (auto node : backup_nn_list) {
-            if (!ant.is_visited(node)) {
-                chosen_node = node;
-                break ;
+        // The trails are stored in the order of the candidate list
+        double products[::MaxCandListSize];
+        auto heuristic_it = cl_heuristic_cache.begin() + node * cl_size;
+        pheromone.refresh_row(node, [&](uint32_t j, double trail) {
+            products[j] = heuristic_it[j] * trail;
+        });
+        const auto row = &nn_product_cache[node * cl_size];
+        Precision::store_products(products, cl_size, row);
+
+        if (!nn_cumulative_cache.empty()) {
+            auto cumulative_it = nn_cumulative_cache.begin() + node * cl_size;
+            product_sum_t<typename Precision::product_t> sum = 0;
+            for (uint32_t j = 0; j < cl_size; ++j) {
+                sum += row[j];
+                cumulative_it[j] = sum;
             }
         }
-        if (chosen_node == max_node) {  // Still nothing selected
-            chosen_node = select_max_product_node(current_node, ant, pheromone, heuristic);
-        }
     }
-    assert(chosen_node != current_node);
-    return chosen_node;
 }
 
+
 void calc_cand_list_heuristic_cache(HeuristicData &heuristic,
                                     uint32_t cl_size,
                                     vector<double> &cache) {
-    const auto &problem = heuristic.problem_;
-    const auto dimension = problem.dimension_;
-    cache.resize(cl_size * dimension);
-    for (uint32_t node = 0 ; node < dimension ; ++node) {
-        auto cache_it = cache.begin() + node * cl_size;
-        for (auto &nn : problem.get_nearest_neighbors(node, cl_size)) {
-            auto value = heuristic.get(node, nn);
-            *cache_it++ = value;
-        }
-    }
+    heuristic.fill_cand_list_cache(cl_size, cache);
 }
 
 
@@ -420,21 +505,24 @@ public:
     }
 };
 
-class CandListModel : public ACOModel<CandListModel> {
-    std::unique_ptr<CandListPheromone> pheromone_ = nullptr;
+template<typename Trail_t>
+class CandListModel : public ACOModel<CandListModel<Trail_t>> {
+    using Base = ACOModel<CandListModel<Trail_t>>;
+
+    std::unique_ptr<CandListPheromone<Trail_t>> pheromone_ = nullptr;
 public:
 
     CandListModel(const ProblemInstance &problem, const ProgramOptions &options)
-        : ACOModel(problem, options)
+        : Base(problem, options)
     {}
 
-    CandListPheromone &get_pheromone_impl() { return *pheromone_; }
+    CandListPheromone<Trail_t> &get_pheromone_impl() { return *pheromone_; }
 
     void init_impl() {
-        pheromone_ = std::make_unique<CandListPheromone>(
-                problem_.get_nn_lists(cand_list_size_),
-                trail_limits_.max_,
-                problem_.is_symmetric_);
+        pheromone_ = std::make_unique<CandListPheromone<Trail_t>>(
+                this->problem_.get_nn_lists(this->cand_list_size_),
+                this->trail_limits_.max_,
+                this->problem_.is_symmetric_);
     }
 };
 
@@ -463,10 +551,14 @@ par_build_initial_routes(const ProblemInstance &problem,
     }
 
     std::vector<std::vector<uint32_t>> routes(sol_count);
+    std::vector<uint32_t> start_nodes(sol_count);
+    for (auto &node : start_nodes) {
+        node = get_rng().next_uint32(problem.dimension_);
+    }
 
+    #pragma omp parallel for default(none) shared(problem, routes, start_nodes, sol_count)
     for (uint32_t i = 0; i < sol_count; ++i) {
-        auto start_node = get_rng().next_uint32(problem.dimension_);
-        routes[i] = problem.build_nn_tour(start_node);
+        routes[i] = problem.build_nn_tour(start_nodes[i]);
     }
 
     if (use_local_search) {
@@ -479,7 +571,159 @@ par_build_initial_routes(const ProblemInstance &problem,
     return routes;
 }
 
-template<typename ComputationsLog_t>
+/*
+ * Lengths of the paths going from the first node of a route to each of its
+ * nodes. These allow to compute the length of any part of the route in O(1)
+ * time.
+ */
+struct RoutePrefixLengths {
+    // lengths_[i] is the length of route[0..i], the last element is the
+    // length of the whole (closed) route
+    std::vector<double> lengths_;
+
+    void update(const ProblemInstance &problem, const std::vector<uint32_t> &route) {
+        lengths_.resize(route.size() + 1);
+        lengths_[0] = 0;
+        for (size_t i = 1; i < route.size(); ++i) {
+            lengths_[i] = lengths_[i - 1] + problem.get_distance(route[i - 1], route[i]);
+        }
+        lengths_.back() = lengths_[route.size() - 1]
+                        + problem.get_distance(route.back(), route.front());
+    }
+
+    // Length of the path going (forward) from position first to position last
+    [[nodiscard]] double get_path_length(size_t first, size_t last) const {
+        return (first <= last) ? lengths_[last] - lengths_[first]
+                               : lengths_.back() - lengths_[first] + lengths_[last];
+    }
+};
+
+
+// The cost of a solution is updated incrementally, this is used to validate
+// it in the debug mode
+bool has_valid_cost(const ProblemInstance &problem, const Solution &sol) {
+    const auto cost = problem.calculate_route_length(sol.route_);
+    return std::abs(sol.cost_ - cost) <= 1e-9 * std::max(1.0, cost);
+}
+
+
+/*
+ * Stopping criteria other than the iterations count: the time limit (counted
+ * from the construction of the object, i.e. the start of the algorithm) and
+ * the target cost of the best solution. The target relative error is
+ * converted to the cost, if the best known solution value is available.
+ */
+struct StoppingCriteria {
+    double time_limit_ = 0;   // In seconds, 0 means no limit
+    double target_cost_ = 0;  // 0 means no target
+    Timer timer_;
+
+    StoppingCriteria(const ProblemInstance &problem, const ProgramOptions &opt)
+        : time_limit_(opt.time_limit_),
+          target_cost_(opt.target_cost_) {
+
+        if (opt.target_error_ >= 0) {
+            if (problem.best_known_cost_ > 0) {
+                const auto cost = problem.best_known_cost_ * (1 + opt.target_error_ / 100);
+                target_cost_ = std::max(target_cost_, cost);
+            } else {
+                cout << "Warning: --target-error is ignored, the best known solution"
+                     << " value for " << problem.name_ << " is not available" << endl;
+            }
+        }
+    }
+
+    [[nodiscard]] bool is_met(double best_cost) const {
+        return (target_cost_ > 0 && best_cost <= target_cost_)
+            || (time_limit_ > 0 && timer_() >= time_limit_);
+    }
+};
+
+
+// Copies of the ant's route used by the local search, one per thread
+struct LocalSearchTours {
+    DoubleLinkedListSolution list_;
+    TreeSolution tree_;
+};
+
+
+template<typename Tour>
+void local_search_on_copy(const ProblemInstance &problem,
+                          LocalSearchType ls_type,
+                          Ant &ant,
+                          Tour &tour,
+                          std::vector<uint32_t> &checklist,
+                          uint32_t nn_list_size) {
+    tour.update(ant.route_, ant.cost_);
+    local_search(problem, ls_type, tour, checklist, nn_list_size);
+    tour.get_route(ant.route_);
+    ant.update_node_indices();
+    ant.cost_ = tour.cost_;
+}
+
+
+/*
+ * Applies the local search to the ant's route. Depending on the tour_type,
+ * the LS works directly on the ant (array representation) or on a copy of
+ * the route stored in one of the tours. The ant's node indices have to be
+ * valid.
+ */
+void apply_local_search(const ProblemInstance &problem,
+                        LocalSearchType ls_type,
+                        TourType tour_type,
+                        Ant &ant,
+                        LocalSearchTours &tours,
+                        std::vector<uint32_t> &checklist,
+                        uint32_t nn_list_size) {
+    switch (tour_type) {
+        case TWO_LEVEL_LIST_TOUR:
+            local_search_on_copy(problem, ls_type, ant, tours.list_, checklist, nn_list_size);
+            break ;
+        case TREE_TOUR:
+            local_search_on_copy(problem, ls_type, ant, tours.tree_, checklist, nn_list_size);
+            break ;
+        default:
+            local_search(problem, ls_type, static_cast<Solution &>(ant), checklist, nn_list_size);
+    }
+}
+
+
+/*
+ * Performs the relocations of the nodes (i.e. modifications of the source
+ * solution made by an ant) followed by the local search. If the tree tour is
+ * used, both are performed on the tree, in O(log n) time per operation, and
+ * the resulting route is copied to the ant.
+ */
+template<typename Relocations>
+void relocate_and_improve(const ProblemInstance &problem,
+                          LocalSearchType ls_type,
+                          TourType tour_type,
+                          bool use_ls,
+                          Ant &ant,
+                          LocalSearchTours &tours,
+                          std::vector<uint32_t> &checklist,
+                          uint32_t nn_list_size,
+                          Relocations relocate_nodes) {
+    if (tour_type == TREE_TOUR) {
+        auto &tree = tours.tree_;
+        relocate_nodes(tree);
+        if (use_ls) {
+            local_search(problem, ls_type, tree, checklist, nn_list_size);
+        }
+        tree.get_route(ant.route_);
+        ant.update_node_indices();
+        ant.cost_ = tree.cost_;
+    } else {
+        relocate_nodes(ant);
+        if (use_ls) {
+            apply_local_search(problem, ls_type, tour_type, ant, tours,
+                               checklist, nn_list_size);
+        }
+    }
+}
+
+
+template<typename Precision, typename ComputationsLog_t>
 std::unique_ptr<Solution> 
 run_focused_aco(const ProblemInstance &problem,
                 const ProgramOptions &opt,
@@ -490,7 +734,10 @@ run_focused_aco(const ProblemInstance &problem,
     const auto bl_size    = opt.backup_list_size_;
     const auto ants_count = opt.ants_count_;
     const auto iterations = opt.iterations_;
+    const StoppingCriteria stopping_criteria(problem, opt);
     const auto use_ls     = opt.local_search_ != 0;
+    const auto ls_type    = get_local_search_type(opt.local_search_type_);
+    const auto tour_type  = get_tour_type(opt.tour_type_);
 
     Timer start_sol_timer;
     const auto start_routes = par_build_initial_routes(problem, use_ls);
@@ -511,19 +758,12 @@ run_focused_aco(const ProblemInstance &problem,
     comp_log("initial sol cost", initial_cost);
 
     HeuristicData heuristic(problem, opt.beta_);
-    vector<double> cl_heuristic_cache;
+    vector<typename Precision::heuristic_t> cl_heuristic_cache;
 
-    cl_heuristic_cache.resize(cl_size * dimension);
-    for (uint32_t node = 0 ; node < dimension ; ++node) {
-        auto cache_it = cl_heuristic_cache.begin() + node * cl_size;
-
-        for (auto &nn : problem.get_nearest_neighbors(node, cl_size)) {
-            *cache_it++ = heuristic.get(node, nn);
-        }
-    }
+    heuristic.fill_cand_list_cache(cl_size, cl_heuristic_cache);
 
     // Probabilistic model based on pheromone trails:
-    CandListModel model(problem, opt);
+    CandListModel<typename Precision::trail_t> model(problem, opt);
     // If the LS is on, the differences between pheromone trails should be
     // smaller -- we use calc_trail_limits_cl instead of calc_trail_limits
     model.calc_trail_limits_ = !use_ls ? calc_trail_limits : calc_trail_limits_cl;
@@ -531,7 +771,14 @@ run_focused_aco(const ProblemInstance &problem,
     auto &pheromone = model.get_pheromone();
     pheromone.set_all_trails(model.trail_limits_.max_);
 
-    vector<double> nn_product_cache(dimension * cl_size);
+    vector<typename Precision::product_t> nn_product_cache(dimension * cl_size);
+    // Used only if the precomputed row sampling is on
+    using ProductSum_t = product_sum_t<typename Precision::product_t>;
+    vector<ProductSum_t> nn_cumulative_cache(opt.row_sampling_ ? dimension * cl_size : 0);
+
+    const PseudoRandomProportionalSelection<PrecomputedRowSelection<ProductSum_t>> selection{
+        opt.q0_, { opt.row_sampling_ ? nn_cumulative_cache.data() : nullptr }
+    };
 
     auto best_ant = make_unique<Ant>(start_route, initial_cost);
 
@@ -539,6 +786,10 @@ run_focused_aco(const ProblemInstance &problem,
     Ant *iteration_best = nullptr;
 
     auto source_solution = make_unique<Solution>(start_route, best_ant->cost_);
+    // Used to compute the lengths of the parts of the source_solution copied
+    // by the ants
+    RoutePrefixLengths source_lengths;
+    source_lengths.update(problem, source_solution->route_);
 
     // The following are mainly for raporting purposes
     int64_t select_next_node_calls = 0;
@@ -554,26 +805,27 @@ run_focused_aco(const ProblemInstance &problem,
 
     double  pher_deposition_time = 0;
 
+    // Set by the master thread before the barrier preceding the pheromone
+    // update, so that all threads leave the loop after the same iteration
+    bool stop = false;
+    int32_t completed_iterations = 0;
+
     #pragma omp parallel default(shared)
     {
         // Endpoints of new edges (not present in source_route) are inserted
         // into ls_checklist and later used to guide local search
         vector<uint32_t> ls_checklist;
         ls_checklist.reserve(dimension);
+        LocalSearchTours ls_tours;
+        NearestUnvisitedSearch nearest_unvisited(problem);
 
-        for (int32_t iteration = 0 ; iteration < iterations ; ++iteration) {
+        for (int32_t iteration = 0 ; iteration < iterations && !stop ; ++iteration) {
             #pragma omp barrier
 
             // Load pheromone * heuristic for each edge connecting nearest
             // neighbors (up to cl_size)
-            #pragma omp for schedule(static)
-            for (uint32_t node = 0 ; node < dimension ; ++node) {
-                auto cache_it = nn_product_cache.begin() + node * cl_size;
-                auto heuristic_it = cl_heuristic_cache.begin() + node * cl_size;
-                for (auto &nn : problem.get_nearest_neighbors(node, cl_size)) {
-                    *cache_it++ = *heuristic_it++ * pheromone.get(node, nn);
-                }
-            }
+            update_nn_product_cache<Precision>(problem, pheromone, cl_heuristic_cache,
+                                    cl_size, nn_product_cache, nn_cumulative_cache);
 
             #pragma omp master
             select_next_node_calls = 0;
@@ -589,6 +841,8 @@ run_focused_aco(const ProblemInstance &problem,
 
                 auto &ant = ants[ant_idx];
                 ant.initialize(dimension);
+                nearest_unvisited.reset();
+                ant.cost_ = 0;
 
                 auto start_node = get_rng().next_uint32(dimension);
                 ant.visit(start_node);
@@ -603,12 +857,13 @@ run_focused_aco(const ProblemInstance &problem,
 
                 while (ant.visited_count_ < dimension) {
                     auto curr = ant.get_current_node();
-                    auto next = select_next_node(pheromone, heuristic,
+                    auto next = select_next_node(selection, pheromone, heuristic,
                                                  problem.get_nearest_neighbors(curr, cl_size),
                                                  nn_product_cache,
                                                  problem.get_backup_neighbors(curr, cl_size, bl_size),
-                                                 ant);
+                                                 ant, curr, nearest_unvisited);
                     ant.visit(next);
+                    ant.cost_ += problem.get_distance(curr, next);
 
                     ++select_next_node_calls;
 
@@ -624,19 +879,29 @@ run_focused_aco(const ProblemInstance &problem,
                     if (new_edges >= target_new_edges) {
                         // Forward direction, start at { next, succ(next) }
                         auto it = source_solution->get_iterator(next);
+                        const auto next_pos = it.position_;
                         while (ant.try_visit(it.goto_succ()) ) {
                         }
                         // Backward direction
                         it.goto_pred();  // Reverse .goto_succ() from above
+                        const auto last_pos = it.position_;
                         while (ant.try_visit(it.goto_pred()) ) {
                         }
+                        it.goto_succ();  // The last node visited by the loop
+                        // The copied edges form the source paths
+                        // next_pos..last_pos and it.position_..last_pos
+                        ant.cost_ += source_lengths.get_path_length(next_pos, last_pos)
+                                   + source_lengths.get_path_length(it.position_, last_pos);
                     }
                 }
+                ant.cost_ += problem.get_distance(ant.route_.back(), ant.route_.front());
                 if (use_ls) {
-                    two_opt_nn(problem, ant.route_, ls_checklist, opt.ls_cand_list_size_);
+                    ant.update_node_indices();
+                    apply_local_search(problem, ls_type, tour_type, ant, ls_tours,
+                                       ls_checklist, opt.ls_cand_list_size_);
                 }
 
-                ant.cost_ = problem.calculate_route_length(ant.route_);
+                assert(has_valid_cost(problem, ant));
                 sol_costs[ant_idx] = ant.cost_;
             }
 
@@ -649,7 +914,7 @@ run_focused_aco(const ProblemInstance &problem,
                     }
                 }
                 if (iteration_best->cost_ < best_ant->cost_) {
-                    best_ant->update(iteration_best->route_, iteration_best->cost_);
+                    best_ant->update(iteration_best);
 
                     auto error = problem.calc_relative_error(best_ant->cost_);
                     best_cost_trace.add({ best_ant->cost_, error }, iteration, main_timer());
@@ -664,6 +929,9 @@ run_focused_aco(const ProblemInstance &problem,
 
                 mean_cost_trace.add(round(sample_mean(sol_costs), 1), iteration);
                 stdev_cost_trace.add(round(sample_stdev(sol_costs), 1), iteration);
+
+                completed_iterations = iteration + 1;
+                stop = stopping_criteria.is_met(best_ant->cost_);
             }
 
             // Synchronize threads before pheromone update
@@ -684,17 +952,19 @@ run_focused_aco(const ProblemInstance &problem,
 
                 // Increase pheromone values on the edges of the new
                 // source_solution
-                source_solution->update(update_ant.route_, update_ant.cost_);
+                source_solution->update(&update_ant);
+                source_lengths.update(problem, source_solution->route_);
             }
         }
     }
     comp_log("pher_deposition_time", pher_deposition_time);
+    comp_log("completed iterations", completed_iterations);
 
     return unique_ptr<Solution>(dynamic_cast<Solution*>(best_ant.release()));
 }
 
 
-template<typename ComputationsLog_t>
+template<typename Precision, typename ComputationsLog_t>
 std::unique_ptr<Solution> 
 run_facor(const ProblemInstance &problem,
                 const ProgramOptions &opt,
@@ -705,7 +975,10 @@ run_facor(const ProblemInstance &problem,
     const auto bl_size    = opt.backup_list_size_;
     const auto ants_count = opt.ants_count_;
     const auto iterations = opt.iterations_;
+    const StoppingCriteria stopping_criteria(problem, opt);
     const auto use_ls     = opt.local_search_ != 0;
+    const auto ls_type    = get_local_search_type(opt.local_search_type_);
+    const auto tour_type  = get_tour_type(opt.tour_type_);
 
     Timer start_sol_timer;
     const auto start_routes = par_build_initial_routes(problem, use_ls);
@@ -724,19 +997,12 @@ run_facor(const ProblemInstance &problem,
     comp_log("Initial tour cost:", initial_cost);
 
     HeuristicData heuristic(problem, opt.beta_);
-    vector<double> cl_heuristic_cache;
+    vector<typename Precision::heuristic_t> cl_heuristic_cache;
 
-    cl_heuristic_cache.resize(cl_size * dimension);
-    for (uint32_t node = 0 ; node < dimension ; ++node) {
-        auto cache_it = cl_heuristic_cache.begin() + node * cl_size;
-
-        for (auto &nn : problem.get_nearest_neighbors(node, cl_size)) {
-            *cache_it++ = heuristic.get(node, nn);
-        }
-    }
+    heuristic.fill_cand_list_cache(cl_size, cl_heuristic_cache);
 
     // Probabilistic model based on pheromone trails:
-    CandListModel model(problem, opt);
+    CandListModel<typename Precision::trail_t> model(problem, opt);
     // If the LS is on, the differences between pheromone trails should be
     // smaller -- we use calc_trail_limits_cl instead of calc_trail_limits
     model.calc_trail_limits_ = !use_ls ? calc_trail_limits : calc_trail_limits_cl;
@@ -744,7 +1010,14 @@ run_facor(const ProblemInstance &problem,
     auto &pheromone = model.get_pheromone();
     pheromone.set_all_trails(model.trail_limits_.max_);
 
-    vector<double> nn_product_cache(dimension * cl_size);
+    vector<typename Precision::product_t> nn_product_cache(dimension * cl_size);
+    // Used only if the precomputed row sampling is on
+    using ProductSum_t = product_sum_t<typename Precision::product_t>;
+    vector<ProductSum_t> nn_cumulative_cache(opt.row_sampling_ ? dimension * cl_size : 0);
+
+    const PseudoRandomProportionalSelection<PrecomputedRowSelection<ProductSum_t>> selection{
+        opt.q0_, { opt.row_sampling_ ? nn_cumulative_cache.data() : nullptr }
+    };
 
     auto best_ant = make_unique<Ant>(start_route, initial_cost);
 
@@ -762,26 +1035,27 @@ run_facor(const ProblemInstance &problem,
 
     double  pher_deposition_time = 0;
 
+    // Set by the master thread before the barrier preceding the pheromone
+    // update, so that all threads leave the loop after the same iteration
+    bool stop = false;
+    int32_t completed_iterations = 0;
+
     #pragma omp parallel default(shared)
     {
         // Endpoints of new edges (not present in source_route) are inserted
         // into ls_checklist and later used to guide local search
         vector<uint32_t> ls_checklist;
         ls_checklist.reserve(dimension);
+        LocalSearchTours ls_tours;
+        NearestUnvisitedSearch nearest_unvisited(problem);
 
-        for (int32_t iteration = 0 ; iteration < iterations ; ++iteration) {
+        for (int32_t iteration = 0 ; iteration < iterations && !stop ; ++iteration) {
             #pragma omp barrier
 
             // Load pheromone * heuristic for each edge connecting nearest
             // neighbors (up to cl_size)
-            #pragma omp for schedule(static)
-            for (uint32_t node = 0 ; node < dimension ; ++node) {
-                auto cache_it = nn_product_cache.begin() + node * cl_size;
-                auto heuristic_it = cl_heuristic_cache.begin() + node * cl_size;
-                for (auto &nn : problem.get_nearest_neighbors(node, cl_size)) {
-                    *cache_it++ = *heuristic_it++ * pheromone.get(node, nn);
-                }
-            }
+            update_nn_product_cache<Precision>(problem, pheromone, cl_heuristic_cache,
+                                    cl_size, nn_product_cache, nn_cumulative_cache);
 
             #pragma omp master
             select_next_node_calls = 0;
@@ -797,9 +1071,12 @@ run_facor(const ProblemInstance &problem,
 
                 auto &ant = ants[ant_idx];
                 ant.initialize(dimension);
+                nearest_unvisited.reset();
 
+                // The route is built by relocating nodes in a copy of the
+                // source solution, so the start node is only marked
                 auto start_node = get_rng().next_uint32(dimension);
-                ant.visit(start_node);
+                ant.mark_visited(start_node);
 
                 ls_checklist.clear();
                 ls_checklist.push_back(start_node);
@@ -807,36 +1084,40 @@ run_facor(const ProblemInstance &problem,
                 // We are counting edges (undirected) that are not present in
                 // the source_route. The factual # of new edges can be +1 as we
                 // skip the check for the closing edge (minor optimization).
-                uint32_t new_edges = 0, k = 0;
-                uint32_t u = start_node;
-                ant.update(source_solution->route_, source_solution->cost_);
-                ant.visited_bitmask_.set_bit(u);
-                while (k < dimension && new_edges < target_new_edges) {
-                    auto v = select_next_node_(pheromone, heuristic,
-                                                 problem.get_nearest_neighbors(u, cl_size),
-                                                 nn_product_cache,
-                                                 problem.get_backup_neighbors(u, cl_size, bl_size),
-                                                 ant, u);
-                    ant.visited_bitmask_.set_bit(v);
-                    ant.relocate(u, v);
+                // Relocations are performed on the ant's route or on the
+                // tree, depending on the tour_type
+                auto relocate_nodes = [&](auto &sol) {
+                    uint32_t new_edges = 0, k = 0;
+                    uint32_t u = start_node;
+                    sol.update(source_solution.get());
+                    ant.mark_visited(u);
+                    // All the nodes are visited after dimension - 1 steps
+                    while (k + 1 < dimension && new_edges < target_new_edges) {
+                        auto v = select_next_node(selection, pheromone, heuristic,
+                                                  problem.get_nearest_neighbors(u, cl_size),
+                                                  nn_product_cache,
+                                                  problem.get_backup_neighbors(u, cl_size, bl_size),
+                                                  ant, u, nearest_unvisited);
+                        ant.mark_visited(v);
+                        sol.relocate(u, v, problem);
                     
-                    auto v_pred = ant.get_pred(v);
+                        auto v_pred = sol.get_pred(v);
 
-                    if (!source_solution->contains_edge(u, v)) {
-                        ++new_edges;
-                        ls_checklist.push_back(u);
-                        ls_checklist.push_back(v);
-                        ls_checklist.push_back(v_pred);
-                    }
+                        if (!source_solution->contains_edge(u, v)) {
+                            ++new_edges;
+                            ls_checklist.push_back(u);
+                            ls_checklist.push_back(v);
+                            ls_checklist.push_back(v_pred);
+                        }
 
-                    u = v; 
-                    ++k;
-                }
-                if (use_ls) {
-                    two_opt_nn(problem, ant.route_, ls_checklist, opt.ls_cand_list_size_);
-                }
+                        u = v; 
+                        ++k;
+                    }
+                };
+                relocate_and_improve(problem, ls_type, tour_type, use_ls, ant, ls_tours,
+                                     ls_checklist, opt.ls_cand_list_size_, relocate_nodes);
 
-                ant.cost_ = problem.calculate_route_length(ant.route_);
+                assert(has_valid_cost(problem, ant));
                 sol_costs[ant_idx] = ant.cost_;
             }
 
@@ -849,13 +1130,16 @@ run_facor(const ProblemInstance &problem,
                     }
                 }
                 if (iteration_best->cost_ < best_ant->cost_) {
-                    best_ant->update(iteration_best->route_, iteration_best->cost_);
+                    best_ant->update(iteration_best);
 
                     auto error = problem.calc_relative_error(best_ant->cost_);
                     best_cost_trace.add({ best_ant->cost_, error }, iteration, main_timer());
 
                     model.update_trail_limits(best_ant->cost_);
                 }
+
+                completed_iterations = iteration + 1;
+                stop = stopping_criteria.is_met(best_ant->cost_);
             }
 
             // Synchronize threads before pheromone update
@@ -876,16 +1160,17 @@ run_facor(const ProblemInstance &problem,
 
                 // Increase pheromone values on the edges of the new
                 // source_solution
-                source_solution->update(update_ant.route_, update_ant.cost_);
+                source_solution->update(&update_ant);
             }
         }
     }
     comp_log("pher_deposition_time", pher_deposition_time);
+    comp_log("completed iterations", completed_iterations);
 
     return unique_ptr<Solution>(dynamic_cast<Solution*>(best_ant.release()));
 }
 
-template<typename ComputationsLog_t>
+template<typename Precision, typename ComputationsLog_t>
 std::unique_ptr<Solution> 
 run_rgaco(const ProblemInstance &problem,
                 const ProgramOptions &opt,
@@ -896,7 +1181,10 @@ run_rgaco(const ProblemInstance &problem,
     const auto bl_size    = opt.backup_list_size_;
     const auto ants_count = opt.ants_count_;
     const auto iterations = opt.iterations_;
+    const StoppingCriteria stopping_criteria(problem, opt);
     const auto use_ls     = opt.local_search_ != 0;
+    const auto ls_type    = get_local_search_type(opt.local_search_type_);
+    const auto tour_type  = get_tour_type(opt.tour_type_);
 
     Timer start_sol_timer;
     const auto start_routes = par_build_initial_routes(problem, use_ls);
@@ -915,19 +1203,12 @@ run_rgaco(const ProblemInstance &problem,
     comp_log("Initial tour cost:", initial_cost);
 
     HeuristicData heuristic(problem, opt.beta_);
-    vector<double> cl_heuristic_cache;
-
-    cl_heuristic_cache.resize(cl_size * dimension);
-    for (uint32_t node = 0 ; node < dimension ; ++node) {
-        auto cache_it = cl_heuristic_cache.begin() + node * cl_size;
+    vector<typename Precision::heuristic_t> cl_heuristic_cache;
 
-        for (auto &nn : problem.get_nearest_neighbors(node, cl_size)) {
-            *cache_it++ = heuristic.get(node, nn);
-        }
-    }
+    heuristic.fill_cand_list_cache(cl_size, cl_heuristic_cache);
 
     // Probabilistic model based on pheromone trails:
-    CandListModel model(problem, opt);
+    CandListModel<typename Precision::trail_t> model(problem, opt);
 
     model.calc_trail_limits_ = calc_trail_limits_smooth;
     model.init(initial_cost);
@@ -935,7 +1216,14 @@ run_rgaco(const ProblemInstance &problem,
     pheromone.set_all_trails(model.trail_limits_.max_);
     cout << "Trail min: " << model.trail_limits_.min_ << endl;
 
-    vector<double> nn_product_cache(dimension * cl_size);
+    vector<typename Precision::product_t> nn_product_cache(dimension * cl_size);
+    // Used only if the precomputed row sampling is on
+    using ProductSum_t = product_sum_t<typename Precision::product_t>;
+    vector<ProductSum_t> nn_cumulative_cache(opt.row_sampling_ ? dimension * cl_size : 0);
+
+    const PseudoRandomProportionalSelection<PrecomputedRowSelection<ProductSum_t>> selection{
+        opt.q0_, { opt.row_sampling_ ? nn_cumulative_cache.data() : nullptr }
+    };
 
     auto best_ant = make_unique<Ant>(start_route, initial_cost);
 
@@ -953,26 +1241,27 @@ run_rgaco(const ProblemInstance &problem,
 
     double  pher_deposition_time = 0;
 
+    // Set by the master thread before the barrier preceding the pheromone
+    // update, so that all threads leave the loop after the same iteration
+    bool stop = false;
+    int32_t completed_iterations = 0;
+
     #pragma omp parallel default(shared)
     {
         // Endpoints of new edges (not present in source_route) are inserted
         // into ls_checklist and later used to guide local search
         vector<uint32_t> ls_checklist;
         ls_checklist.reserve(dimension);
+        LocalSearchTours ls_tours;
+        NearestUnvisitedSearch nearest_unvisited(problem);
 
-        for (int32_t iteration = 0 ; iteration < iterations ; ++iteration) {
+        for (int32_t iteration = 0 ; iteration < iterations && !stop ; ++iteration) {
             #pragma omp barrier
 
             // Load pheromone * heuristic for each edge connecting nearest
             // neighbors (up to cl_size)
-            #pragma omp for schedule(static)
-            for (uint32_t node = 0 ; node < dimension ; ++node) {
-                auto cache_it = nn_product_cache.begin() + node * cl_size;
-                auto heuristic_it = cl_heuristic_cache.begin() + node * cl_size;
-                for (auto &nn : problem.get_nearest_neighbors(node, cl_size)) {
-                    *cache_it++ = *heuristic_it++ * pheromone.get(node, nn);
-                }
-            }
+            update_nn_product_cache<Precision>(problem, pheromone, cl_heuristic_cache,
+                                    cl_size, nn_product_cache, nn_cumulative_cache);
 
             #pragma omp master
             select_next_node_calls = 0;
@@ -989,72 +1278,74 @@ run_rgaco(const ProblemInstance &problem,
 
                 auto &ant = ants[ant_idx];
                 ant.initialize(dimension);
+                nearest_unvisited.reset();
 
+                // The route is built by relocating nodes in a copy of the
+                // source solution, so the start node is only marked
                 auto start_node = get_rng().next_uint32(dimension);
-                ant.visit(start_node);
+                ant.mark_visited(start_node);
 
                 ls_checklist.clear();
                 ls_checklist.push_back(start_node);
 
-                uint32_t u = start_node;
-                ant.update(source_solution->route_, source_solution->cost_);
-                ant.visited_bitmask_.set_bit(u);
+                uint32_t best_changes_pos = 0;  // 0 - not selected yet
 
-                vector<uint32_t> changes(max_changes);
-                uint32_t best_changes_pos = -1;
-                double best_cost = numeric_limits<double>::max();
-                for (uint32_t changes_pos = 1; changes_pos <= max_changes; ++changes_pos) {
-                    auto u_next = ant.get_succ(u);
-                    ant.visited_bitmask_.set_bit(u_next);
-                    
-                    auto nn_list = problem.get_nearest_neighbors(u, cl_size);
-                    auto nn = *nn_list.begin();
-                    bool use_nn = get_rng().next_float() < 0.5 && !ant.is_visited(nn);
-                    auto v = use_nn ? nn : select_next_node_(pheromone, heuristic,
-                                                 nn_list,
-                                                 nn_product_cache,
-                                                 problem.get_backup_neighbors(u, cl_size, bl_size),
-                                                 ant, u);
-                    ant.visited_bitmask_.set_bit(v);
-                    
-                    auto v_pred = ant.get_pred(v);
+                // Relocations are performed on the ant's route or on the
+                // tree, depending on the tour_type
+                auto relocate_nodes = [&](auto &sol) {
+                    uint32_t u = start_node;
+                    sol.update(source_solution.get());
+                    ant.mark_visited(u);
 
-                    ant.relocate_rgaco(u, v, problem);
+                    vector<uint32_t> changes(max_changes);
+                    double best_cost = numeric_limits<double>::max();
+                    for (uint32_t changes_pos = 1; changes_pos <= max_changes; ++changes_pos) {
+                        auto u_next = sol.get_succ(u);
+                        ant.mark_visited(u_next);
+                    
+                        auto nn_list = problem.get_nearest_neighbors(u, cl_size);
+                        auto nn = *nn_list.begin();
+                        bool use_nn = get_rng().next_float() < 0.5 && !ant.is_visited(nn);
+                        auto v = use_nn ? nn : select_next_node(selection, pheromone, heuristic,
+                                                     nn_list,
+                                                     nn_product_cache,
+                                                     problem.get_backup_neighbors(u, cl_size, bl_size),
+                                                     ant, u, nearest_unvisited);
+                        ant.mark_visited(v);
+
+                        sol.relocate(u, v, problem);
+
+                        changes[changes_pos - 1] = v; 
+                        double cur_cost = sol.cost_ * pow(get_rng().next_float(), 0.5);
+                        if (changes_pos >= min_changes && cur_cost < best_cost) {
+                            best_cost = cur_cost;
+                            best_changes_pos = changes_pos;
+                        }
 
-                    changes[changes_pos - 1] = v; 
-                    double cur_cost = ant.cost_ * pow(get_rng().next_float(), 0.5);
-                    if (changes_pos >= min_changes && cur_cost < best_cost) {
-                        best_cost = cur_cost;
-                        best_changes_pos = changes_pos;
+                        u = v;
                     }
 
-                    u = v;
-                }
+                    // simulate the best solution, it is selected among the
+                    // prefixes of at least min_changes relocations
+                    assert(best_changes_pos > 0);
 
-                // simulate the best solution
-                if (best_changes_pos == -1) {
-                    cout << "HOW tf this happned" << '\n';
-                    abort();
-                }
+                    u = start_node;
+                    sol.update(source_solution.get());
+                    for (size_t i = 1; i <= best_changes_pos; ++i) {
+                        auto v = changes[i - 1];
+                        auto v_pred = sol.get_pred(v);
 
-                u = start_node;
-                ant.update(source_solution->route_, source_solution->cost_);
-                for (size_t i = 1; i <= best_changes_pos; ++i) {
-                    auto v = changes[i - 1];
-                    auto v_pred = ant.get_pred(v);
-
-                    ant.relocate_rgaco(u, v, problem);
-                    ls_checklist.push_back(u);
-                    ls_checklist.push_back(v);
-                    ls_checklist.push_back(v_pred);
-                    u = v;
-                }
-
-                if (use_ls) {
-                    two_opt_nn(problem, ant.route_, ls_checklist, opt.ls_cand_list_size_);
-                }
+                        sol.relocate(u, v, problem);
+                        ls_checklist.push_back(u);
+                        ls_checklist.push_back(v);
+                        ls_checklist.push_back(v_pred);
+                        u = v;
+                    }
+                };
+                relocate_and_improve(problem, ls_type, tour_type, use_ls, ant, ls_tours,
+                                     ls_checklist, opt.ls_cand_list_size_, relocate_nodes);
 
-                ant.cost_ = problem.calculate_route_length(ant.route_);
+                assert(has_valid_cost(problem, ant));
                 sol_costs[ant_idx] = ant.cost_;
                 ant.changes_count = best_changes_pos;
             }
@@ -1068,7 +1359,7 @@ run_rgaco(const ProblemInstance &problem,
                     }
                 }
                 if (iteration_best->cost_ < best_ant->cost_) {
-                    best_ant->update(iteration_best->route_, iteration_best->cost_);
+                    best_ant->update(iteration_best);
 
                     //assert(iteration_best->validate());
 
@@ -1077,6 +1368,9 @@ run_rgaco(const ProblemInstance &problem,
 
                     model.update_trail_limits(best_ant->cost_);
                 }
+
+                completed_iterations = iteration + 1;
+                stop = stopping_criteria.is_met(best_ant->cost_);
             }
 
             // Synchronize threads before pheromone update
@@ -1097,10 +1391,11 @@ run_rgaco(const ProblemInstance &problem,
 
                 // Increase pheromone values on the edges of the new
                 // source_solution
-                source_solution->update(update_ant.route_, update_ant.cost_);
+                source_solution->update(&update_ant);
             }
         }
     }
+    comp_log("completed iterations", completed_iterations);
 
     return unique_ptr<Solution>(dynamic_cast<Solution*>(best_ant.release()));
 }
@@ -1137,6 +1432,22 @@ fs::path get_results_file_path(const ProgramOptions &args, const ProblemInstance
     return get_results_dir_path(args) / get_results_filename(problem, args.algorithm_);
 }
 
+/*
+ * Returns the instance of the algorithm (one of the given ones) which uses
+ * the precision policy selected with the --precision option.
+ */
+template<typename Fn>
+Fn select_precision(const std::string &precision, Fn double_fn, Fn float_fn, Fn q16_fn) {
+    if (precision == "double") {
+        return double_fn;
+    } else if (precision == "float") {
+        return float_fn;
+    } else if (precision == "q16") {
+        return q16_fn;
+    }
+    throw runtime_error("Unknown precision: " + precision);
+}
+
 int main(int argc, char *argv[]) {
     using json = nlohmann::json;
     using Log = ComputationsLog<json>;
@@ -1159,33 +1470,99 @@ int main(int argc, char *argv[]) {
         json experiment_record;
         Log exp_log(experiment_record, std::cout);
 
-        auto problem = load_tsplib_instance(args.problem_path_.c_str());
+        auto nn_count = std::max(args.cand_list_size_ + args.backup_list_size_,
+                                 args.ls_cand_list_size_);
+        const auto &cand_list_type = args.cand_list_type_;
+        if (cand_list_type != "nn" && cand_list_type != "quadrant" && cand_list_type != "alpha") {
+            throw runtime_error("Unknown candidate list type: " + cand_list_type);
+        }
+        // The alpha-nearness is computed using a sparse graph of the quadrant
+        // neighbors, so that the clusters of nodes are connected
+        const auto quadrant_count = cand_list_type != "nn" ? args.cand_list_size_ : 0;
+        const uint32_t graph_degree = std::max(args.cand_list_size_, 10u);
+        const uint32_t ascent_iterations = 100;
+
+        // The cached lists are valid only for the same parameters
+        const auto lists_key = hash_string(cand_list_type
+                                           + " " + to_string(nn_count)
+                                           + " " + to_string(quadrant_count)
+                                           + " " + to_string(graph_degree)
+                                           + " " + to_string(ascent_iterations));
+        std::string cache_path;
+        uint64_t instance_hash = 0;
+        std::optional<ProblemInstance> cached;
+
+        Timer load_timer;
+        if (!args.cache_dir_.empty()) {
+            std::ostringstream name;
+            name << fs::path(args.problem_path_).stem().string()
+                 << '.' << std::hex << lists_key << ".cache";
+            cache_path = (fs::path(args.cache_dir_) / name.str()).string();
+            instance_hash = hash_file(args.problem_path_.c_str());
+            cached = load_cached_instance(cache_path, instance_hash, lists_key);
+        }
+        auto problem = cached ? std::move(*cached)
+                              : load_tsplib_instance(args.problem_path_.c_str(), args.print_header_);
+        cached.reset();
+        exp_log("instance load time", load_timer());
+        exp_log("instance from cache", !cache_path.empty() && problem.cache_file_ != nullptr);
         load_best_known_solutions("best-known.json");
         problem.best_known_cost_ = get_best_known_value(problem.name_, -1);
 
+        Timer matrix_timer;
+        problem.compute_distance_matrix(size_t{args.max_matrix_mb_} << 20);
+        exp_log("distance matrix calc time", matrix_timer());
+
         Timer nn_lists_timer;
-        auto nn_count = std::max(args.cand_list_size_ + args.backup_list_size_,
-                                 args.ls_cand_list_size_);
-        problem.compute_nn_lists(nn_count);
+        if (problem.cache_file_ == nullptr) {
+            problem.compute_nn_lists(nn_count, quadrant_count);
+            if (cand_list_type == "alpha") {
+                problem.order_nn_lists_by_alpha(graph_degree, ascent_iterations);
+            }
+            if (!cache_path.empty() && problem.edge_weight_type_ != EXPLICIT) {
+                // The cache is only an optimization, so the failure to write
+                // it should not stop the computations
+                try {
+                    fs::create_directories(args.cache_dir_);
+                    save_cached_instance(cache_path, problem, instance_hash, lists_key);
+                } catch (const runtime_error &e) {
+                    cout << "Warning: the instance was not cached: " << e.what() << endl;
+                }
+            }
+        }
+        // The LS needs the neighbors ordered by the distance (also if the
+        // lists were loaded from the cache)
+        if (cand_list_type != "nn") {
+            problem.compute_ls_lists(args.ls_cand_list_size_);
+        }
         exp_log("nn and backup lists calc time", nn_lists_timer());
 
         aco_fn alg = nullptr; 
         if (args.algorithm_ == "rgaco") {
-            alg = run_rgaco;
+            alg = select_precision<aco_fn>(args.precision_,
+                                           run_rgaco<DoublePrecision, Log>,
+                                           run_rgaco<FloatPrecision, Log>,
+                                           run_rgaco<Quantized16Precision, Log>);
 
             if (args.ants_count_ == 0) {
                 auto r = 4 * sqrt(problem.dimension_);
                 args.ants_count_ = static_cast<uint32_t>(lround(r / 64) * 64);
             }
         } else if (args.algorithm_ == "facor") {
-            alg = run_facor;
+            alg = select_precision<aco_fn>(args.precision_,
+                                           run_facor<DoublePrecision, Log>,
+                                           run_facor<FloatPrecision, Log>,
+                                           run_facor<Quantized16Precision, Log>);
 
             if (args.ants_count_ == 0) {
                 auto r = 4 * sqrt(problem.dimension_);
                 args.ants_count_ = static_cast<uint32_t>(lround(r / 64) * 64);
             }
         } else if (args.algorithm_ == "faco") {
-            alg = run_focused_aco;
+            alg = select_precision<aco_fn>(args.precision_,
+                                           run_focused_aco<DoublePrecision, Log>,
+                                           run_focused_aco<FloatPrecision, Log>,
+                                           run_focused_aco<Quantized16Precision, Log>);
 
             if (args.ants_count_ == 0) {
                 auto r = 4 * sqrt(problem.dimension_);
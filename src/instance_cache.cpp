@@ -0,0 +1,159 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "instance_cache.h"
+#include "mapped_file.h"
+
+namespace {
+
+const char CacheMagic[8] = { 'F', 'A', 'C', 'O', 'I', 'N', 'S', 'T' };
+
+// Should be increased whenever the layout of the file changes
+const uint32_t CacheVersion = 1;
+
+/*
+ * The file starts with the header, followed by the name of the instance
+ * (padded with zeros to a multiple of 8 bytes), the coordinates, the
+ * distances to the nearest neighbors and the nearest neighbor lists. All of
+ * the arrays are properly aligned if the file is mapped at a page boundary.
+ */
+struct CacheHeader {
+    char magic_[8];
+    uint32_t version_;
+    uint32_t dimension_;
+    uint64_t instance_hash_;
+    uint64_t lists_key_;
+    uint32_t edge_weight_type_;
+    uint32_t is_symmetric_;
+    uint32_t nn_per_node_;
+    uint32_t name_length_;
+};
+
+size_t get_padded_length(size_t length) {
+    return (length + 7) / 8 * 8;
+}
+
+size_t get_file_size(const CacheHeader &header) {
+    const size_t n = header.dimension_;
+    const size_t list_entries = n * header.nn_per_node_;
+    return sizeof(CacheHeader)
+         + get_padded_length(header.name_length_)
+         + n * sizeof(Vec2d)
+         + list_entries * sizeof(double)
+         + list_entries * sizeof(uint32_t);
+}
+
+uint64_t fnv1a_hash(const char *data, size_t length) {
+    uint64_t hash = UINT64_C(0xCBF29CE484222325);
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= UINT64_C(0x100000001B3);
+    }
+    return hash;
+}
+
+}  // namespace
+
+
+uint64_t hash_file(const char *path) {
+    const MappedFile file(path);
+    return fnv1a_hash(file.data(), file.size());
+}
+
+
+uint64_t hash_string(const std::string &text) {
+    return fnv1a_hash(text.data(), text.size());
+}
+
+
+std::optional<ProblemInstance> load_cached_instance(const std::string &path,
+                                                    uint64_t instance_hash,
+                                                    uint64_t lists_key) {
+    if (access(path.c_str(), R_OK) != 0) {
+        return std::nullopt;
+    }
+    auto file = std::make_shared<const MappedFile>(path.c_str());
+    if (file->size() < sizeof(CacheHeader)) {
+        return std::nullopt;
+    }
+    CacheHeader header {};
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (std::memcmp(header.magic_, CacheMagic, sizeof(CacheMagic)) != 0
+            || header.version_ != CacheVersion
+            || header.instance_hash_ != instance_hash
+            || header.lists_key_ != lists_key
+            || file->size() != get_file_size(header)) {
+        return std::nullopt;
+    }
+
+    const auto *data = file->data() + sizeof(CacheHeader);
+    std::string name(data, header.name_length_);
+    data += get_padded_length(header.name_length_);
+
+    const auto n = header.dimension_;
+    const auto *coords_data = reinterpret_cast<const Vec2d *>(data);
+    std::vector<Vec2d> coords(coords_data, coords_data + n);
+    data += n * sizeof(Vec2d);
+
+    const size_t list_entries = size_t{n} * header.nn_per_node_;
+    const auto *distances = reinterpret_cast<const double *>(data);
+    data += list_entries * sizeof(double);
+    const auto *lists = reinterpret_cast<const uint32_t *>(data);
+
+    std::optional<ProblemInstance> problem;
+    problem.emplace(n, static_cast<EdgeWeightType>(header.edge_weight_type_),
+                    std::move(coords), std::vector<double>{},
+                    header.is_symmetric_ != 0, name);
+    problem->use_cached_lists(std::move(file), header.nn_per_node_, lists, distances);
+    return problem;
+}
+
+
+void save_cached_instance(const std::string &path,
+                          const ProblemInstance &problem,
+                          uint64_t instance_hash,
+                          uint64_t lists_key) {
+    assert(problem.edge_weight_type_ != EXPLICIT);
+    assert(problem.nn_lists_data_ != nullptr && problem.nn_distances_data_ != nullptr);
+
+    CacheHeader header {};
+    std::memcpy(header.magic_, CacheMagic, sizeof(CacheMagic));
+    header.version_ = CacheVersion;
+    header.dimension_ = problem.dimension_;
+    header.instance_hash_ = instance_hash;
+    header.lists_key_ = lists_key;
+    header.edge_weight_type_ = problem.edge_weight_type_;
+    header.is_symmetric_ = problem.is_symmetric_;
+    header.nn_per_node_ = problem.total_nn_per_node_;
+    header.name_length_ = static_cast<uint32_t>(problem.name_.size());
+
+    const auto tmp_path = path + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream out(tmp_path, std::ios::binary);
+        const size_t list_entries = size_t{problem.dimension_} * problem.total_nn_per_node_;
+        const char padding[8] = {};
+
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(problem.name_.data(), static_cast<std::streamsize>(problem.name_.size()));
+        out.write(padding, static_cast<std::streamsize>(get_padded_length(problem.name_.size())
+                                                        - problem.name_.size()));
+        out.write(reinterpret_cast<const char *>(problem.coords_.data()),
+                  static_cast<std::streamsize>(problem.dimension_ * sizeof(Vec2d)));
+        out.write(reinterpret_cast<const char *>(problem.nn_distances_data_),
+                  static_cast<std::streamsize>(list_entries * sizeof(double)));
+        out.write(reinterpret_cast<const char *>(problem.nn_lists_data_),
+                  static_cast<std::streamsize>(list_entries * sizeof(uint32_t)));
+        if (!out) {
+            std::remove(tmp_path.c_str());
+            throw std::runtime_error("Cannot write instance cache file: " + tmp_path);
+        }
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        throw std::runtime_error("Cannot write instance cache file: " + path);
+    }
+}
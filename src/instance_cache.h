@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "problem_instance.h"
+
+/*
+ * Binary cache of preprocessed instances. A cache file stores the instance's
+ * coordinates with its nearest neighbor lists and the distances to the
+ * neighbors, so that neither the TSPLIB file needs to be parsed nor the lists
+ * computed again. The file is memory-mapped when loaded and the lists are
+ * used directly from it.
+ *
+ * A cache file is valid only for the same contents of the TSPLIB file (as
+ * given by its hash) and the same lists key, which should identify the
+ * parameters used to compute the lists. Only the instances with coordinates
+ * are cached, i.e. not the EXPLICIT ones.
+ */
+
+// Returns a 64-bit FNV-1a hash of the file's contents
+uint64_t hash_file(const char *path);
+
+// Returns a 64-bit FNV-1a hash of the text, e.g. of the lists' parameters
+uint64_t hash_string(const std::string &text);
+
+/*
+ * Returns the instance loaded from the cache file at path, or nothing if the
+ * file does not exist or is not valid for the given hashes.
+ */
+std::optional<ProblemInstance> load_cached_instance(const std::string &path,
+                                                    uint64_t instance_hash,
+                                                    uint64_t lists_key);
+
+/*
+ * Writes the instance with its (already computed) nearest neighbor lists to
+ * the cache file at path. The file is first written under a temporary name
+ * and then renamed, so that concurrent runs never see a partial file.
+ *
+ * Throws runtime_error if the file cannot be written.
+ */
+void save_cached_instance(const std::string &path,
+                          const ProblemInstance &problem,
+                          uint64_t instance_hash,
+                          uint64_t lists_key);
@@ -64,7 +64,6 @@ public:
         double cutval_ = 0;
         Bounds bounds_;
         int8_t cutdim_ = 0;
-        bool is_empty_ = true;
 
         [[nodiscard]] bool is_bucket() const { return bucket_start_ != -1; }
     };
@@ -77,10 +76,6 @@ public:
     uint32_t root_ = Sentinel;
     std::vector<uint32_t> point_idx_to_node_;
 
-    uint32_t nn_target_pt_idx_ = 0;
-    int nn_pt_idx_ = 0;
-    double nn_dist_ = 0;
-
 
     explicit KDTree(const std::vector<Point> &points) {
         points_ = points;
@@ -104,7 +99,6 @@ public:
         nodes_.push_back(Node{});
 
         auto *p = &nodes_.back();
-        p->is_empty_ = false;
         p->bounds_ = bounds;
 
         if (u - l + 1 <= cutoff_) {
@@ -188,19 +182,6 @@ public:
     }
 
 
-    uint32_t nn(uint32_t point_idx) {
-        assert(point_idx < points_.size());
-        assert(root_ != Sentinel);
-
-        nn_target_pt_idx_ = point_idx;
-
-        nn_dist_ = std::numeric_limits<double>::max();
-        rnn(root_);
-
-        return nn_pt_idx_;
-    }
-
-
     /**
      * Outputs tree in Graphviz format for an easy visualization of the tree.
      * Example:
@@ -213,12 +194,12 @@ public:
      * 
      * will produce PDF file with the tree visualization.
      */
-    void print_in_dot_format(uint32_t node_id, std::ostream &out) {
+    void print_in_dot_format(uint32_t node_id, std::ostream &out) const {
         if (node_id == root_) {
             out << "digraph G {\n";
         }
 
-        auto &node = nodes_.at(node_id);
+        const auto &node = nodes_.at(node_id);
         if ( node.is_bucket() ) {
             out << "\t" << node_id << " [label=\"";
             for (auto i = node.bucket_start_; i <= node.bucket_end_; i++) {
@@ -248,71 +229,87 @@ public:
     }
 
 
-    void rnn(uint32_t node_id) {
-        auto *p = &nodes_.at(node_id);
-
-        if (p->is_bucket()) {
-            for (auto i = p->bucket_start_; i <= p->bucket_end_; i++) {
-                auto pt_id = bucket_points_[i];
-                if (pt_id != nn_target_pt_idx_) {
-                    auto dist = get_distance(pt_id, nn_target_pt_idx_);
-                    if (dist < nn_dist_) {
-                        nn_dist_ = dist;
-                        nn_pt_idx_ = static_cast<int32_t>(pt_id);
-                    }
-                }
-            }
-        } else {
-            auto val = p->cutval_;
-            auto coord = get_coordinate(points_[nn_target_pt_idx_], p->cutdim_);
-            if (coord < val) {
-                rnn(p->left_);
-                if (coord + nn_dist_ > val) {
-                    rnn(p->right_);
-                }
-            } else {
-                rnn(p->right_);
-                if (coord - nn_dist_ < val) {
-                    rnn(p->left_);
-                }
-            }
-        }
+    /*
+     * Finds the k points (other than point_idx) nearest to the given point
+     * w.r.t. the distance function. The result holds pairs (distance, point)
+     * sorted by the distance, the ties are broken in favor of the point with
+     * the smallest index. The same assumptions about the distance are made as
+     * in KDTreeView::nn.
+     *
+     * This does not modify the tree so can be called by many threads at once,
+     * each with its own result vector. It is used as a bounded max-heap
+     * during the search.
+     */
+    template<typename DistanceFn>
+    void knn(uint32_t point_idx, uint32_t k, DistanceFn distance,
+             std::vector<std::pair<double, uint32_t>> &result) const {
+        constexpr auto inf = std::numeric_limits<double>::infinity();
+        knn_in_region(point_idx, k, distance, Bounds{ -inf, inf, -inf, inf }, result);
     }
 
-
-    uint32_t nn_bottom_up(uint32_t point_idx) {
+    /*
+     * As knn but only the points inside the region (including its borders)
+     * are considered. The subtrees lying outside of the region are skipped.
+     */
+    template<typename DistanceFn>
+    void knn_in_region(uint32_t point_idx, uint32_t k, DistanceFn distance,
+                       const Bounds &region,
+                       std::vector<std::pair<double, uint32_t>> &result) const {
         assert(point_idx < points_.size());
         assert(root_ != Sentinel);
 
-        nn_target_pt_idx_ = point_idx;
-        nn_dist_ = std::numeric_limits<double>::max();
-        const auto node_id = point_idx_to_node_.at(point_idx);
-        rnn(node_id);
+        result.clear();
+        if (k > 0) {
+            knn_helper(root_, point_idx, k, distance, region, result);
+        }
+        std::sort_heap(result.begin(), result.end());
+    }
 
-        auto *p = &nodes_.at(node_id);
-        while (true) {
-            auto *lastp = p;
-            if (p->parent_ == Sentinel) {
-                break ;
-            }
-            p = &nodes_.at(p->parent_);
-            auto coord = get_coordinate(points_[nn_target_pt_idx_], p->cutdim_);
-            auto diff = coord - p->cutval_;
-            if (nn_dist_ >= fabs(diff)) {
-                if (lastp == &nodes_.at(p->left_)) {
-                    rnn(p->right_);
-                } else {
-                    rnn(p->left_);
+    template<typename DistanceFn>
+    void knn_helper(uint32_t node_id, uint32_t point_idx, uint32_t k, DistanceFn &distance,
+                    const Bounds &region,
+                    std::vector<std::pair<double, uint32_t>> &heap) const {
+        const auto &node = nodes_[node_id];
+        if (node.is_bucket()) {
+            for (auto i = node.bucket_start_; i <= node.bucket_end_; ++i) {
+                const auto pt_id = bucket_points_[i];
+                if (pt_id == point_idx) {
+                    continue ;
+                }
+                const auto &pt = points_[pt_id];
+                if (pt.x_ < region.x_min_ || pt.x_ > region.x_max_
+                        || pt.y_ < region.y_min_ || pt.y_ > region.y_max_) {
+                    continue ;
                 }
+                const std::pair<double, uint32_t> entry { distance(point_idx, pt_id), pt_id };
+                if (heap.size() < k) {
+                    heap.push_back(entry);
+                    std::push_heap(heap.begin(), heap.end());
+                } else if (entry < heap.front()) {
+                    std::pop_heap(heap.begin(), heap.end());
+                    heap.back() = entry;
+                    std::push_heap(heap.begin(), heap.end());
+                }
+            }
+        } else {
+            const auto diff = get_coordinate(points_[point_idx], node.cutdim_) - node.cutval_;
+            // The left subtree holds the points with the coordinate <= cutval
+            const auto region_min = node.cutdim_ == 0 ? region.x_min_ : region.y_min_;
+            const auto region_max = node.cutdim_ == 0 ? region.x_max_ : region.y_max_;
+            const bool visit_left  = region_min <= node.cutval_;
+            const bool visit_right = region_max >= node.cutval_;
+            const auto near = diff < 0 ? node.left_ : node.right_;
+            const auto far  = diff < 0 ? node.right_ : node.left_;
+
+            if (diff < 0 ? visit_left : visit_right) {
+                knn_helper(near, point_idx, k, distance, region, heap);
             }
-            // We use + 1 so that TSPLIB rounded distance calculation can be
-            // handled properly
-            if (ball_in_bounds(p->bounds_, nn_target_pt_idx_, nn_dist_ + 1)) {
-                break ;
+            // + 1 is for the rounding of the distances (and the ties)
+            if ((diff < 0 ? visit_right : visit_left)
+                    && (heap.size() < k || std::fabs(diff) <= heap.front().first + 1)) {
+                knn_helper(far, point_idx, k, distance, region, heap);
             }
         }
-
-        return nn_pt_idx_;
     }
 
 
@@ -326,141 +323,129 @@ public:
         // return int(std::sqrt(dx*dx + dy*dy) + 0.5);
         return static_cast<double>(lround(std::sqrt(dx*dx + dy*dy)));
     }
+};
 
 
-    Node &get_node(uint32_t node_id) {
-        assert(node_id < nodes_.size());
-        return nodes_[node_id];
-    }
-
+/**
+ * A view of a KDTree with its own set of deleted points. The tree is shared
+ * and not modified by the view, so every thread can use its own view of the
+ * same tree, e.g. to find the nearest unvisited nodes.
+ *
+ * For every node of the tree the view stores the number of its points which
+ * are not deleted, so that the empty subtrees are skipped by the searches.
+ */
+class KDTreeView {
+public:
+    static constexpr uint32_t Sentinel = KDTree::Sentinel;
 
-    Node *get_parent(Node &node) {
-        return (node.parent_ != Sentinel)
-             ? &get_node(node.parent_)
-             : nullptr;
+    explicit KDTreeView(const KDTree &tree)
+        : tree_(tree),
+          deleted_(tree.get_points_count(), 0),
+          live_counts_(tree.nodes_.size(), 0) {
+        count_points(tree_.root_);
     }
 
+    [[nodiscard]] bool is_deleted(uint32_t point_idx) const {
+        return deleted_[point_idx] != 0;
+    }
 
     void delete_point(uint32_t point_idx) {
-        assert(point_idx < point_idx_to_node_.size());
-        auto node_id = point_idx_to_node_.at(point_idx);
-
-        assert(node_id < nodes_.size());
-        auto *p = &nodes_.at(node_id);
-        auto j = p->bucket_start_;
-        while (bucket_points_[j] != point_idx) {
-            ++j;
+        if (is_deleted(point_idx)) {
+            return ;
         }
-        std::swap( bucket_points_[j], bucket_points_[p->bucket_end_] );
-        --p->bucket_end_;
-        if (p->bucket_start_ > p->bucket_end_) {
-            p->is_empty_ = true;
-
-            while ( (p = get_parent(*p)) != nullptr
-                    && nodes_.at(p->left_).is_empty_
-                    && nodes_.at(p->right_).is_empty_ ) {
-                p->is_empty_ = true;
-            }
+        deleted_[point_idx] = 1;
+        deleted_points_.push_back(point_idx);
+        for (auto node_id = tree_.point_idx_to_node_[point_idx]; node_id != Sentinel;
+                  node_id = tree_.nodes_[node_id].parent_) {
+            --live_counts_[node_id];
         }
     }
 
-
-    void undelete_point(uint32_t point_idx) {
-        auto node_id = point_idx_to_node_.at(point_idx);
-        auto *p = &nodes_.at(node_id);
-        auto j = p->bucket_start_;
-        while (bucket_points_[j] != point_idx) {
-            ++j;
-        }
-        ++p->bucket_end_;
-        std::swap( bucket_points_[j], bucket_points_[p->bucket_end_] );
-        if (p->is_empty_) {
-            p->is_empty_ = false;
-
-            while ( (p = get_parent(*p)) != nullptr
-                    && p->is_empty_ ) {
-                p->is_empty_ = false;
+    // Restores all the deleted points
+    void reset() {
+        // Undoing the deletions one by one takes O(log(n)) time per point
+        if (deleted_points_.size() * 16 < deleted_.size()) {
+            for (auto point_idx : deleted_points_) {
+                deleted_[point_idx] = 0;
+                for (auto node_id = tree_.point_idx_to_node_[point_idx]; node_id != Sentinel;
+                          node_id = tree_.nodes_[node_id].parent_) {
+                    ++live_counts_[node_id];
+                }
             }
+        } else {
+            std::fill(deleted_.begin(), deleted_.end(), 0);
+            count_points(tree_.root_);
         }
+        deleted_points_.clear();
     }
 
-
-    [[nodiscard]] bool ball_in_bounds(const Bounds &bounds, uint32_t point_idx,
-                        double radius) const {
-        assert(radius >= 0);
-
-        const auto &pt = points_.at(point_idx);
-        auto x = pt.x_;
-        auto y = pt.y_;
-
-        return (bounds.x_min_ <= x - radius)
-            && (bounds.x_max_ >= x + radius)
-            && (bounds.y_min_ <= y - radius)
-            && (bounds.y_max_ >= y + radius);
+    /*
+     * Returns the point (other than point_idx) which is not deleted and is
+     * the nearest to the given point w.r.t. the distance function, or
+     * Sentinel if there is none. The ties are broken in favor of the point
+     * with the smallest index.
+     *
+     * It is assumed that the distance is not smaller than the Euclidean
+     * distance minus 1, e.g. it is the rounded or the ceiling of the
+     * Euclidean distance.
+     */
+    template<typename DistanceFn>
+    [[nodiscard]] uint32_t nn(uint32_t point_idx, DistanceFn distance) const {
+        assert(point_idx < deleted_.size());
+        NNSearch<DistanceFn> search { point_idx, distance };
+        search_nn(tree_.root_, search);
+        return search.nn_pt_idx_;
     }
 
-    [[maybe_unused]] void fixed_radius_nn(uint32_t point_idx, double radius,
-                         std::vector<uint32_t> &result) {
-        nn_target_pt_idx_ = point_idx;
-        nn_dist_ = radius;
-
-        const auto node_id = point_idx_to_node_.at(point_idx);
-        auto *p = &nodes_.at(node_id);
-        auto p_id = node_id;
-
-        result.clear();
-
-        fixed_radius_nn_helper(p_id, result);
+private:
+    const KDTree &tree_;
+    std::vector<uint8_t> deleted_;
+    std::vector<uint32_t> live_counts_;  // # of not deleted points in a subtree
+    std::vector<uint32_t> deleted_points_;
+
+    template<typename DistanceFn>
+    struct NNSearch {
+        uint32_t target_pt_idx_;
+        DistanceFn distance_;
+        uint32_t nn_pt_idx_ = Sentinel;
+        double nn_dist_ = std::numeric_limits<double>::max();
+    };
 
-        while (true) {
-            auto prev_p = p_id;
-            if (p->parent_ == Sentinel) {
-                break ;
-            }
-            p_id = p->parent_;
-            p = &nodes_.at(p->parent_);
-            auto coord = get_coordinate(points_[nn_target_pt_idx_], p->cutdim_);
-            auto diff = coord - p->cutval_;
-            if (prev_p == p->left_) {
-                if (nn_dist_ >= -diff) {
-                    fixed_radius_nn_helper(p->right_, result);
-                }
-            } else {
-                if (nn_dist_ >= diff) {
-                    fixed_radius_nn_helper(p->left_, result);
-                }
-            }
-            if (ball_in_bounds(p->bounds_, nn_target_pt_idx_, nn_dist_ + 1)) {
-                break ;
-            }
-        }
+    uint32_t count_points(uint32_t node_id) {
+        const auto &node = tree_.nodes_[node_id];
+        const auto count = node.is_bucket()
+                         ? static_cast<uint32_t>(node.bucket_end_ - node.bucket_start_ + 1)
+                         : count_points(node.left_) + count_points(node.right_);
+        live_counts_[node_id] = count;
+        return count;
     }
 
-    void fixed_radius_nn_helper(uint32_t node_id, std::vector<uint32_t> &result) {
-        auto *p = &nodes_.at(node_id);
-        if (p->is_empty_) {
+    template<typename DistanceFn>
+    void search_nn(uint32_t node_id, NNSearch<DistanceFn> &search) const {
+        if (live_counts_[node_id] == 0) {
             return ;
         }
-        if (p->is_bucket()) {
-            for (auto i = p->bucket_start_; i <= p->bucket_end_; i++) {
-                auto dist = get_distance(bucket_points_[i], nn_target_pt_idx_);
-                if (dist <= nn_dist_ && bucket_points_[i] != nn_target_pt_idx_) {
-                    result.push_back(bucket_points_[i]);
+        const auto &node = tree_.nodes_[node_id];
+        if (node.is_bucket()) {
+            for (auto i = node.bucket_start_; i <= node.bucket_end_; ++i) {
+                const auto pt_id = tree_.bucket_points_[i];
+                if (pt_id != search.target_pt_idx_ && !is_deleted(pt_id)) {
+                    const auto dist = search.distance_(search.target_pt_idx_, pt_id);
+                    if (dist < search.nn_dist_
+                            || (dist == search.nn_dist_ && pt_id < search.nn_pt_idx_)) {
+                        search.nn_dist_ = dist;
+                        search.nn_pt_idx_ = pt_id;
+                    }
                 }
             }
         } else {
-            auto coord = get_coordinate(points_[nn_target_pt_idx_], p->cutdim_);
-            auto diff = coord - p->cutval_;
-            if (diff < 0.0) {
-                fixed_radius_nn_helper(p->left_, result);
-                if (nn_dist_ >= -diff) {
-                    fixed_radius_nn_helper(p->right_, result);
-                }
-            } else {
-                fixed_radius_nn_helper(p->right_, result);
-                if (nn_dist_ >= diff) {
-                    fixed_radius_nn_helper(p->left_, result);
-                }
+            const auto coord = KDTree::get_coordinate(tree_.points_[search.target_pt_idx_], node.cutdim_);
+            const auto diff = coord - node.cutval_;
+            search_nn(diff < 0 ? node.left_ : node.right_, search);
+            // The points on the other side are at least |diff| away, + 1 is
+            // for the rounding of the distances (and the ties)
+            if (std::fabs(diff) <= search.nn_dist_ + 1) {
+                search_nn(diff < 0 ? node.right_ : node.left_, search);
             }
         }
     }
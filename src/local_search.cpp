@@ -4,14 +4,16 @@
 #include <array>
 #include <algorithm>
 #include <numeric>
+#include <stdexcept>
 
 #include "local_search.h"
+#include "ant.h"
 #include "utils.h"
 
 /*
  * This performs a 2-opt move by flipping a section of the route.
  * The boundaries of the section are given by first and last.
- * 
+ *
  * It may happen that the section is very long compared to the remaining part
  * of the route. In such case, the remaining part is flipped, to speed things
  * up as the result of such flip results in equivalent solution.
@@ -92,7 +94,9 @@ void flip_route_section(std::vector<uint32_t> &route,
  *
  * Returns a number of changes (moves) applied to the route.
  */
+template<typename Distance>
 int64_t two_opt_nn(const ProblemInstance &instance,
+                   const Distance &distance,
                    std::vector<uint32_t> &route,
                    bool use_dont_look_bits,
                    uint32_t nn_count) {
@@ -129,16 +133,18 @@ int64_t two_opt_nn(const ProblemInstance &instance,
             auto a_next = (i + 1 < route_size) ? route[i+1] : route[0];
             auto a_prev = (i > 0) ? route[i-1] : route[route_size-1];
 
-            auto dist_a_to_next = instance.get_distance(a, a_next);
-            auto dist_a_to_prev = instance.get_distance(a, a_prev);
+            auto dist_a_to_next = distance(a, a_next);
+            auto dist_a_to_prev = distance(a, a_prev);
 
             double max_diff = -1;
             uint32_t left = 0;
             uint32_t right = 0;
 
+            const auto *nn_distances = instance.get_ls_nn_distances(a);
+
             uint32_t b_index = 0;
-            for (auto b : instance.get_nearest_neighbors(a, nn_count)) {
-                auto dist_ab = instance.get_distance(a, b);
+            for (auto b : instance.get_ls_neighbors(a, nn_count)) {
+                auto dist_ab = nn_distances[b_index];
                 ++b_index;
 
                 auto b_pos = pos_in_route[b];
@@ -147,9 +153,9 @@ int64_t two_opt_nn(const ProblemInstance &instance,
                     auto b_next = (b_pos + 1 < route_size) ? route[b_pos + 1] : route[0];
 
                     auto diff = dist_a_to_next
-                              + instance.get_distance(b, b_next)
+                              + distance(b, b_next)
                               - dist_ab
-                              - instance.get_distance(a_next, b_next);
+                              - distance(a_next, b_next);
 
                     if (diff > max_diff) {
                         left = std::min(i, b_pos) + 1;
@@ -160,8 +166,8 @@ int64_t two_opt_nn(const ProblemInstance &instance,
             }
 
             b_index = 0;
-            for (auto b : instance.get_nearest_neighbors(a, nn_count)) {
-                auto dist_ab = instance.get_distance(a, b);
+            for (auto b : instance.get_ls_neighbors(a, nn_count)) {
+                auto dist_ab = nn_distances[b_index];
                 ++b_index;
 
                 auto b_pos = pos_in_route[b];
@@ -169,9 +175,9 @@ int64_t two_opt_nn(const ProblemInstance &instance,
                     auto b_prev = (b_pos > 0) ? route[b_pos-1] : route[route_size-1];
 
                     auto diff = dist_a_to_prev
-                              + instance.get_distance(b_prev, b)
+                              + distance(b_prev, b)
                               - dist_ab
-                              - instance.get_distance(a_prev, b_prev);
+                              - distance(a_prev, b_prev);
 
                     if (diff > max_diff) {
                         left = std::min(i, b_pos);
@@ -210,75 +216,78 @@ int64_t two_opt_nn(const ProblemInstance &instance,
 }
 
 
+/*
+ * Appends the node to the checklist unless it is already waiting there to be
+ * checked, i.e. it is at a position >= checklist_pos.
+ */
+void push_to_checklist(std::vector<uint32_t> &checklist,
+                       size_t checklist_pos,
+                       uint32_t node) {
+    if (std::find(checklist.begin() + static_cast<int32_t>(checklist_pos),
+                  checklist.end(), node) == checklist.end()) {
+        checklist.push_back(node);
+    }
+}
+
+
 /**
  * This impl. of the 2-opt heuristic uses a queue of nodes to check for an
  * improving move, i.e. checklist. This is useful to speed up computations
  * if the route was 2-optimal but a few new edges were introduced -- endpoints
  * of the new edges should be inserted into checklist.
  */
+template<typename Tour, typename Distance>
 int64_t two_opt_nn(const ProblemInstance &instance,
-                   std::vector<uint32_t> &route,
+                   const Distance &distance,
+                   Tour &tour,
                    std::vector<uint32_t> &checklist,
                    uint32_t nn_list_size) {
 
     // We assume symmetry so that the order of the nodes does not matter
     assert(instance.is_symmetric_);
 
-    const auto route_size = route.size();
-    std::vector<uint32_t> pos_in_route(route_size);
-
-    for (uint32_t i = 0; i < route_size; ++i) {
-        pos_in_route[ route[i] ] = i;
-    }
-    const auto n = route.size();
-
     // Setting maximum number of allowed route changes prevents very long-running times
     // for very hard to solve TSP instances.
-    const uint32_t MaxChanges = route_size;
+    const uint32_t MaxChanges = instance.dimension_;
     uint32_t changes_count = 0;
 
-    size_t checklist_pos_pos = 0;
-    while (checklist_pos_pos < checklist.size() && changes_count < MaxChanges) {
-        auto a = checklist[checklist_pos_pos++];
+    size_t checklist_pos = 0;
+    while (checklist_pos < checklist.size() && changes_count < MaxChanges) {
+        auto a = checklist[checklist_pos++];
         assert(a < instance.dimension_);
-        auto i = pos_in_route[a];
 
-        auto a_next = (i + 1 < n) ? route[i+1] : route[0];
-        auto a_prev = (i > 0) ? route[i-1] : route[route_size-1];
+        auto a_next = tour.get_succ(a);
+        auto a_prev = tour.get_pred(a);
 
-        auto dist_a_to_next = instance.get_distance(a, a_next);
-        auto dist_a_to_prev = instance.get_distance(a, a_prev);
+        auto dist_a_to_next = distance(a, a_next);
+        auto dist_a_to_prev = distance(a, a_prev);
 
         double max_diff = -1;
-        uint32_t left = 0;
-        uint32_t right = 0;
+        // The best move as (t1, t2, t3, t4), i.e. edges (t1, t2) and (t3, t4)
+        // are replaced with (t1, t3) and (t2, t4)
+        std::array<uint32_t, 4> move{};
 
-        const auto &nn_list = instance.get_nearest_neighbors(a, nn_list_size);
+        const auto &nn_list = instance.get_ls_neighbors(a, nn_list_size);
+        const auto *nn_distances = instance.get_ls_nn_distances(a);
 
-        for (auto b : nn_list) {
-            auto dist_ab = instance.get_distance(a, b);
+        for (uint32_t j = 0; j < nn_list_size; ++j) {
+            const auto b = nn_list[j];
+            auto dist_ab = nn_distances[j];
             if (dist_a_to_next > dist_ab) {
                 // We rotate the section between a and b_next so that
                 // two new (undirected) edges are created: { a, b } and { a_next, b_next }
                 //
                 // a -> a_next ... b -> b_next
                 // a -> b ... a_next -> b_next
-                //
-                // or
-                //
-                // b -> b_next ... a -> a_next
-                // b -> a ... b_next -> a_next
-                auto b_pos = pos_in_route[b];
-                auto b_next = (b_pos + 1 < route_size) ? route[b_pos + 1] : route[0];
+                auto b_next = tour.get_succ(b);
 
                 auto diff = dist_a_to_next
-                          + instance.get_distance(b, b_next)
+                          + distance(b, b_next)
                           - dist_ab
-                          - instance.get_distance(a_next, b_next);
+                          - distance(a_next, b_next);
 
                 if (diff > max_diff) {
-                    left  = std::min(i, b_pos) + 1;
-                    right = std::max(i, b_pos) + 1;
+                    move = { a, a_next, b, b_next };
                     max_diff = diff;
                 }
             } else {
@@ -286,30 +295,24 @@ int64_t two_opt_nn(const ProblemInstance &instance,
             }
         }
 
-        for (auto b : nn_list) {
-            auto dist_ab = instance.get_distance(a, b);
+        for (uint32_t j = 0; j < nn_list_size; ++j) {
+            const auto b = nn_list[j];
+            auto dist_ab = nn_distances[j];
             if (dist_a_to_prev > dist_ab) {
                 // We rotate the section between a_prev and b so that
                 // two new (undirected) edges are created: { a, b } and { a_prev, b_prev }
                 //
                 // a_prev -> a ... b_prev -> b
                 // a_prev -> b_prev ... a -> b
-                //
-                // or
-                //
-                // b_prev -> b ... a_prev -> a
-                // b_prev -> a_prev ... b -> a
-                auto b_pos = pos_in_route[b];
-                auto b_prev = (b_pos > 0) ? route[b_pos-1] : route[route_size-1];
+                auto b_prev = tour.get_pred(b);
 
                 auto diff = dist_a_to_prev
-                          + instance.get_distance(b_prev, b)
+                          + distance(b_prev, b)
                           - dist_ab
-                          - instance.get_distance(a_prev, b_prev);
+                          - distance(a_prev, b_prev);
 
                 if (diff > max_diff) {
-                    left  = std::min(i, b_pos);
-                    right = std::max(i, b_pos);
+                    move = { a, a_prev, b, b_prev };
                     max_diff = diff;
                 }
             } else {
@@ -318,190 +321,300 @@ int64_t two_opt_nn(const ProblemInstance &instance,
         }
 
         if (max_diff > 0) {
-            flip_route_section(route, pos_in_route, static_cast<int32_t>(left), static_cast<int32_t>(right));
-
-            // Add nodes at the beginning/end of the flipped segment
-            // and the non-flipped part
-            uint32_t endpoints[] = {
-                route[left],
-                route[right-1],
-                route[(left > 0) ? left-1 : route_size-1],
-                route[(right < route_size) ? right : 0]
-            };
-
-            for (auto x : endpoints) {
-                if (std::find(checklist.begin() + static_cast<int32_t>(checklist_pos_pos),
-                              checklist.end(), x) == checklist.end()) {
-                    checklist.push_back(x);
-                }
+            tour.flip(move[0], move[1], move[2], move[3]);
+            tour.cost_ -= max_diff;
+
+            // Add endpoints of the new edges
+            for (auto x : move) {
+                push_to_checklist(checklist, checklist_pos, x);
             }
             ++changes_count;
         }
     }
-    assert(instance.is_route_valid(route));
     return changes_count;
 }
 
 
-/*
- * Segment corresponds to a fragment (segment) of a route (vector), i.e. a
- * sequence of consecutive indices of the vector.
+/**
+ * This is an implementation of the Or-opt heuristic which moves a segment of
+ * up to 3 consecutive nodes into another place in the tour, in the original
+ * or reversed order. Similarly to the 2-opt, only the nodes from the
+ * checklist are used as the segments' endpoints, and the new positions are
+ * searched for among the nearest neighbors of the endpoints.
+ *
+ * Each move is performed as a sequence of (at most 3) 2-opt moves.
+ *
+ * Returns a number of changes (moves) applied to the tour.
  */
-struct Segment {
-    uint32_t first_{ 0 }; // Index of the first element belonging to a segment
-    uint32_t last_{ 0 };  // Index of the last element of the segment
-    uint32_t len_{ 0 };   // Length of a whole route (vector)
-    uint32_t id_{ 0 };    // We can give each segment an id / index
-    bool is_reversed_{ false }; // This is used to denote that the order of elements
-                                // within segment should be reversed
-
-    /* Returns length of a segment */
-    [[nodiscard]] uint32_t size() const {
-        if (is_reversed_) {
-            return get_reversed().size();
-        }
-        if (first_ <= last_) {
-            return last_ - first_ + 1;
-        }
-        return len_ - first_ + last_ + 1;
-    }
+template<typename Tour, typename Distance>
+int64_t or_opt_nn(const ProblemInstance &instance,
+                  const Distance &distance,
+                  Tour &tour,
+                  std::vector<uint32_t> &checklist,
+                  uint32_t nn_list_size) {
 
-    void reverse() {
-        std::swap(first_, last_);
-        is_reversed_ = !is_reversed_;
-    }
+    // We assume symmetry so that the order of the nodes does not matter
+    assert(instance.is_symmetric_);
+
+    const auto route_size = instance.dimension_;
+    const uint32_t MaxSegmentLength = 3;
 
-    [[nodiscard]] Segment get_reversed() const {
-        return Segment{ last_, first_, len_, id_, !is_reversed_ };
+    if (route_size < 2 * MaxSegmentLength + 2) {
+        return 0;
     }
 
-    [[nodiscard]] int32_t first() const { return static_cast<int32_t>(first_); }
-    [[nodiscard]] int32_t last() const { return static_cast<int32_t>(last_); }
-    [[nodiscard]] int32_t isize() const { return static_cast<int32_t>(size()); }
-};
+    auto get_succ = [&](uint32_t node) { return tour.get_succ(node); };
+    auto get_pred = [&](uint32_t node) { return tour.get_pred(node); };
 
+    // Setting maximum number of allowed route changes prevents very long-running times
+    // for very hard to solve TSP instances.
+    const uint32_t MaxChanges = route_size;
+    uint32_t changes_count = 0;
 
-struct RelativeIndex {
-    int32_t offset_;
-    int32_t length_;
+    size_t checklist_pos = 0;
+    while (checklist_pos < checklist.size() && changes_count < MaxChanges) {
+        auto a = checklist[checklist_pos++];
+        assert(a < instance.dimension_);
 
-    RelativeIndex(int32_t offset, int32_t length) :
-        offset_(offset), length_(length)
-    {}
+        // The best move found so far. The segment [s1, s2] (in the direction
+        // of traversal) is removed from between p and n, and inserted
+        // between x and y, so that s1 becomes a neighbor of x and s2 of y
+        double max_gain = 0;
+        uint32_t s1 = a, s2 = a, p = a, n = a, x = a, y = a;
 
-    inline int32_t operator()(int32_t index) const {
-        return index + offset_ < length_
-             ? index + offset_
-             : index + offset_ - length_;
-    }
-};
+        const auto &nn_list = instance.get_ls_neighbors(a, nn_list_size);
+        const auto *nn_distances = instance.get_ls_nn_distances(a);
+
+        // The segment starts at a and spans up to MaxSegmentLength nodes in
+        // the forward or backward direction
+        for (int direction = 0; direction < 2; ++direction) {
+            const bool forward = (direction == 0);
+            auto next = [&](uint32_t node) { return forward ? get_succ(node) : get_pred(node); };
+
+            const auto seg_prev = forward ? get_pred(a) : get_succ(a);
+
+            uint32_t segment[MaxSegmentLength];
+            uint32_t seg_end = a;
 
+            for (uint32_t seg_len = 1; seg_len <= MaxSegmentLength; ++seg_len) {
+                if (seg_len > 1) {
+                    seg_end = next(seg_end);
+                }
+                segment[seg_len - 1] = seg_end;
+                const auto seg_next = next(seg_end);
+
+                if (!forward && seg_len == 1) {  // Already checked
+                    continue ;
+                }
+
+                auto in_segment = [&](uint32_t node) {
+                    return std::find(segment, segment + seg_len, node) != segment + seg_len;
+                };
+
+                const auto removal_gain = distance(seg_prev, a)
+                                        + distance(seg_end, seg_next)
+                                        - distance(seg_prev, seg_next);
+                if (removal_gain <= 0) {
+                    continue ;
+                }
 
-void perform_2_opt_move(std::vector<uint32_t> &route, int32_t i, int32_t j) {
-    flip_route_section(route, i+1, j+1);
+                for (uint32_t j = 0; j < nn_list_size; ++j) {
+                    const auto c = nn_list[j];
+                    const auto dist_ac = nn_distances[j];
+                    if (dist_ac >= removal_gain) {
+                        break ;
+                    }
+                    if (in_segment(c)) {
+                        continue ;
+                    }
+                    // Edge { c, e } is replaced with { c, a } and { seg_end, e }
+                    for (auto e : { get_succ(c), get_pred(c) }) {
+                        if (in_segment(e)) {
+                            continue ;
+                        }
+                        const auto gain = removal_gain
+                                        + distance(c, e)
+                                        - dist_ac
+                                        - distance(seg_end, e);
+                        if (gain > max_gain) {
+                            max_gain = gain;
+                            s1 = a;
+                            s2 = seg_end;
+                            p = seg_prev;
+                            n = seg_next;
+                            x = c;
+                            y = e;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (max_gain > 0) {
+            // The orientation in which p -> s1 -> ... -> s2 -> n
+            const bool forward = (get_succ(p) == s1);
+            auto next = [&](uint32_t node) { return forward ? get_succ(node) : get_pred(node); };
+
+            uint32_t endpoints[] = { s1, s2, p, n, x, y };
+
+            // If y -> x then the segment is inserted in the reversed order,
+            // relative to the orientation. Let (u, v) denote the edge { x, y } so
+            // that u -> v.
+            const bool is_reversed = (next(x) != y);
+            auto u = is_reversed ? y : x;
+            auto v = is_reversed ? x : y;
+            if (v == p) {  // Look at the tour in the opposite direction
+                std::swap(s1, s2);
+                std::swap(p, n);
+                std::swap(u, v);
+            }
+            // Now p -> s1 ... s2 -> n and u -> v, where u may be equal to n
+            tour.flip(p, s1, u, v);
+            if (u != n) {
+                tour.flip(p, u, n, s2);
+            }
+            // Now u -> s2 ... s1 -> v
+            if (!is_reversed && s1 != s2) {
+                tour.flip(u, s2, s1, v);
+            }
+
+            tour.cost_ -= max_gain;
+
+            for (auto node : endpoints) {
+                push_to_checklist(checklist, checklist_pos, node);
+            }
+            ++changes_count;
+        }
+    }
+    return changes_count;
 }
 
 
-/**
- * Performs route modifications required by a 3-opt move, i.e. segments
- * reversals and swaps.
+/*
+ * Looks for an improving 2-opt or 3-opt move which removes the edge between
+ * at_i and its successor. The first improving move found is performed and
+ * the endpoints of the new edges are appended to changed_nodes.
  *
- * The longest of the { s0, s1, s2 } segments is not modified, instead the
- * remaining segments are reversed if necessary.
+ * Each 3-opt move is performed as a sequence of 2 or 3 2-opt moves.
  *
- * This works only for the symmetric version of the TSP.
+ * Returns 2 or 3 depending on the type of the performed move, or 0 if no
+ * improving move was found.
  */
-void perform_3_opt_move(std::vector<uint32_t> &route,
-                        Segment s0, Segment s1, Segment s2) {
-    // Sort segments so that the longest one is the first - it
-    // will be kept without changes
-    if (s0.size() < s1.size()) {
-        std::swap(s0, s1);
-    }
-    if (s0.size() < s2.size()) {
-        std::swap(s0, s2);
-    }
-    if (s1.size() < s2.size()) {
-        std::swap(s1, s2);
-    }
-    // Segments should be sorted
-    assert((s0.size() >= s1.size()) && (s1.size() >= s2.size()));
-
-    bool swap_needed = false;  // Do we need to swap shorter segments?
-
-    // We do not want to touch the longest (first) segment so
-    // if it is reversed we reverse the other two instead and do a
-    // swap
-    if (s0.is_reversed_) {
-        s1.reverse();
-        s2.reverse();
-        swap_needed = true;
-    }
-    // segment[0] is OK, so touch only segment[1] and [2]
-    if (s1.is_reversed_) {
-        s1.reverse();
+template<typename Tour, typename Distance>
+int32_t three_opt_move_at(const ProblemInstance &instance,
+                          const Distance &distance,
+                          Tour &tour,
+                          uint32_t at_i,
+                          uint32_t nn_count,
+                          std::vector<uint32_t> &changed_nodes) {
+    using namespace std;
+
+    const auto &i_nn_list = instance.get_ls_neighbors(at_i, nn_count);
+    const auto *i_nn_distances = instance.get_ls_nn_distances(at_i);
+    const auto at_i_1 = tour.get_succ(at_i);
+    const auto dist_i_to_next = distance(at_i, at_i_1);
+
+    for (auto i_nn_idx = 0u; i_nn_idx < nn_count; ++i_nn_idx) {
+        const auto at_j = i_nn_list[i_nn_idx];
+
+        // Check for 2-opt move
+        const auto dist_i_to_j = i_nn_distances[i_nn_idx];
 
-        RelativeIndex idx(static_cast<int32_t>(s1.first_), static_cast<int32_t>(route.size()));
-        for (int32_t l = 0, r = s1.isize() - 1; l < r; ++l, --r) {
-            std::swap(route[idx(l)], route[idx(r)]);
+        // This shortens time considerably although results in longer tours
+        if (dist_i_to_next < dist_i_to_j) {
+            break ;
         }
-    }
-    if (s2.is_reversed_) {
-        s2.reverse();
 
-        RelativeIndex idx(static_cast<int32_t>(s2.first_), static_cast<int32_t>(route.size()));
-        for (int32_t l = 0, r = s2.isize() - 1; l < r; ++l, --r) {
-            std::swap(route[idx(l)], route[idx(r)]);
+        const auto at_j_1 = tour.get_succ(at_j);
+
+        auto cost_before_2opt = dist_i_to_next
+                              + distance(at_j, at_j_1);
+
+        auto cost_after_2opt = dist_i_to_j
+                             + distance(at_i_1, at_j_1);
+
+        if (cost_after_2opt < cost_before_2opt) {
+            tour.flip(at_i, at_i_1, at_j, at_j_1);
+            tour.cost_ -= cost_before_2opt - cost_after_2opt;
+
+            changed_nodes.insert(changed_nodes.end(), { at_i, at_i_1, at_j, at_j_1 });
+            return 2;
         }
-    }
-    if (swap_needed) {
-        auto beg = route.begin();
-
-        // Now perform the swap of s1 and s2, we use std::rotate
-        if (s1.id_ == 2 && s2.id_ == 1) { // 0 2 1, easy case
-            rotate(beg + s2.first(),
-                   beg + s1.first(),
-                   beg + s1.last() + 1);
-        } else if (s1.id_ == 1 && s2.id_ == 2) { // 0 1 2, easy case
-            rotate(beg + s1.first(),
-                   beg + s2.first(),
-                   beg + s2.last() + 1);
-        } else {
-            auto left = 0;
-            auto middle = 0;
-            auto right = s1.isize() + s2.isize();
-
-            if ( (s1.id_ == 0 && s2.id_ == 2) // 1 0 2
-              || (s1.id_ == 1 && s2.id_ == 0) ) {  // 2 1 0
-                left = s2.first();
-                middle = static_cast<int>(s2.size());
-            } else if ( (s1.id_ == 2 && s2.id_ == 0) // 1 2 0
-                     || (s1.id_ == 0 && s2.id_ == 1) ) {  // 2 0 1
-                left = s1.first();
-                middle = static_cast<int>(s1.size());
-            }
 
-            int32_t First = left;
-            auto Middle = static_cast<int32_t>((left + middle) % route.size());
-            auto Last =static_cast<int32_t>((left + right) % route.size());
+        const auto &j_nn_list = instance.get_ls_neighbors(at_j, nn_count);
 
-            auto N = static_cast<int32_t>(route.size());
+        assert(at_i != at_j);  // These two should be different
 
-            auto Next = Middle;
-            while (First != Next) {
-                std::swap (route[First], route[Next]);
+        for (auto j_nn_idx = 0u; j_nn_idx < nn_count; ++j_nn_idx) {
+            const auto at_k = j_nn_list[j_nn_idx];
 
-                First = (First + 1) < N ? First + 1 : 0;
-                Next = (Next + 1) < N ? Next + 1 : 0;
+            if (at_k == at_i) {  // Unlikely but possible, we want at_i != at_j != at_k
+                continue ;
+            }
 
-                if (Next == Last) {
-                    Next = Middle;
-                } else if (First == Middle) {
-                    Middle = Next;
+            // (at_x, at_y, at_z) is (at_i, at_j, at_k) in the tour order
+            const bool is_sorted = tour.between(at_i, at_j, at_k);
+            const auto at_x = at_i;
+            const auto at_y = is_sorted ? at_j : at_k;
+            const auto at_z = is_sorted ? at_k : at_j;
+
+            const auto at_x_1 = at_i_1;
+            const auto at_y_1 = tour.get_succ(at_y);
+            const auto at_z_1 = tour.get_succ(at_z);
+
+            const auto curr = dist_i_to_next
+                            + distance(at_y, at_y_1)
+                            + distance(at_z, at_z_1);
+
+            // 4 sets of possible new edges to check
+            const array<pair<uint32_t, uint32_t>, 4 * 3> edges{{
+                { at_y, at_x   }, { at_z_1, at_y_1 }, {   at_z, at_x_1 },
+                { at_y, at_z_1 }, {   at_x, at_y_1 }, {   at_z, at_x_1 },
+                { at_y, at_z_1 }, {   at_x, at_z   }, { at_y_1, at_x_1 },
+                { at_y, at_z   }, { at_y_1, at_x   }, { at_z_1, at_x_1 }
+            }};
+
+            for (auto l = 0u; l < 4 * 3; l += 3) {
+                auto e1 = edges[l + 0];
+                auto e2 = edges[l + 1];
+                auto e3 = edges[l + 2];
+
+                const auto cost = distance(e1.first, e1.second)
+                                + distance(e2.first, e2.second)
+                                + distance(e3.first, e3.second);
+
+                if (cost < curr) {
+                    // The route is x -> x_1 ... y -> y_1 ... z -> z_1 ... x
+                    switch (l / 3) {
+                        case 0:  // x -> y ... x_1 -> z ... y_1 -> z_1
+                            tour.flip(at_x, at_x_1, at_y, at_y_1);
+                            tour.flip(at_x_1, at_y_1, at_z, at_z_1);
+                            break ;
+                        case 1:  // x -> y_1 ... z -> x_1 ... y -> z_1
+                            tour.flip(at_x, at_x_1, at_y, at_y_1);
+                            tour.flip(at_x, at_y, at_z, at_z_1);
+                            tour.flip(at_x, at_z, at_y_1, at_x_1);
+                            break ;
+                        case 2:  // x -> z ... y_1 -> x_1 ... y -> z_1
+                            tour.flip(at_x, at_x_1, at_y, at_y_1);
+                            tour.flip(at_x, at_y, at_z, at_z_1);
+                            break ;
+                        default:  // x -> y_1 ... z -> y ... x_1 -> z_1
+                            tour.flip(at_y, at_y_1, at_z, at_z_1);
+                            tour.flip(at_x, at_x_1, at_y_1, at_z_1);
+                    }
+                    tour.cost_ -= curr - cost;
+                    changed_nodes.insert(changed_nodes.end(), {
+                        e1.first, e1.second,
+                        e2.first, e2.second,
+                        e3.first, e3.second
+                    });
+                    return 3;
                 }
             }
         }
     }
+    return 0;
 }
 
 
@@ -514,26 +627,25 @@ void perform_3_opt_move(std::vector<uint32_t> &route,
  *
  * The solution's route is modified only if a better order was found.
  *
- * Function returns improvement over the previous route length (travel
- * distance).
- *
  * This implementation is based on the ideas proposed in:
  * Bentley, Jon Jouis. "Fast algorithms for geometric traveling
  * salesman problems." ORSA Journal on computing 4.4 (1992): 387-411.
+ *
+ * Returns a number of changes (moves) applied to the route.
 */
+template<typename Distance>
 int64_t three_opt_nn(const ProblemInstance &instance,
+                     const Distance &distance,
                      std::vector<uint32_t> &sol,
                      bool use_dont_look_bits,
                      uint32_t nn_count) {
-    using namespace std;
-
     assert( instance.is_symmetric_ );
 
     const auto len = static_cast<uint32_t>(sol.size());
-    auto &route = sol;
+    Solution tour(sol, 0);
 
     Bitmask dont_look_bits(len);
-    vector<uint32_t> pos_in_route(len);
+    std::vector<uint32_t> changed_nodes;
 
     int64_t two_opt_changes = 0;
     int64_t three_opt_changes = 0;
@@ -543,163 +655,414 @@ int64_t three_opt_nn(const ProblemInstance &instance,
     do {
         found_improvement = false;
 
-        for (auto i = 0u; i < len; ++i) {
-            pos_in_route[ route[i] ] = i;
-        }
-
         for (auto i = 0u; i < len && !found_improvement; ++i) {
-            const auto at_i = route[i];
+            const auto at_i = tour.route_[i];
 
             if (use_dont_look_bits && dont_look_bits[at_i]) {
                 continue ;  // Do not check, it probably won't find an
                             // improvement
             }
-            const auto &i_nn_list = instance.get_nearest_neighbors(at_i, nn_count);
-
-            for (auto i_nn_idx = 0u; i_nn_idx < nn_count && !found_improvement; ++i_nn_idx) {
-                const auto at_j = i_nn_list[i_nn_idx];
-                const auto j = pos_in_route[at_j];
-
-                // Check for 2-opt move
-                const auto i_1 = (i + 1) % len;
-                const auto j_1 = (j + 1) % len;
-                const auto at_i_1 = route[i_1];
+            changed_nodes.clear();
+            auto move_type = three_opt_move_at(instance, distance, tour, at_i, nn_count, changed_nodes);
+            if (move_type != 0) {
+                found_improvement = true;
 
-                const auto dist_i_to_next = instance.get_distance(at_i, at_i_1);
-                const auto dist_i_to_j = instance.get_distance(at_i, at_j);
+                two_opt_changes += (move_type == 2);
+                three_opt_changes += (move_type == 3);
 
-                // This shortens time considerably although results in longer tours
-                if (dist_i_to_next < dist_i_to_j) {
-                    break ;
+                for (auto node : changed_nodes) {
+                    dont_look_bits.clear_bit(node);
                 }
+            } else if (use_dont_look_bits) {
+                dont_look_bits.set_bit(at_i);
+            }
+        }
+    } while(found_improvement);
 
-                const auto at_j_1 = route[j_1];
+    sol = tour.route_;
+    return two_opt_changes + three_opt_changes;
+}
 
-                auto cost_before_2opt = dist_i_to_next
-                                      + instance.get_distance(at_j, at_j_1);
 
-                auto cost_after_2opt = dist_i_to_j
-                                     + instance.get_distance(at_i_1, at_j_1);
+/*
+ * This impl. of the 3-opt heuristic uses a checklist of nodes instead of
+ * don't look bits, similarly to the two_opt_nn.
+ *
+ * Returns a number of changes (moves) applied to the tour.
+ */
+template<typename Tour, typename Distance>
+int64_t three_opt_nn(const ProblemInstance &instance,
+                     const Distance &distance,
+                     Tour &tour,
+                     std::vector<uint32_t> &checklist,
+                     uint32_t nn_count) {
+    assert( instance.is_symmetric_ );
+
+    std::vector<uint32_t> changed_nodes;
 
-                if (cost_after_2opt < cost_before_2opt) {
-                    perform_2_opt_move(route, static_cast<int32_t>(i), static_cast<int32_t>(j));
+    // Setting maximum number of allowed route changes prevents very long-running times
+    // for very hard to solve TSP instances.
+    const uint32_t MaxChanges = instance.dimension_;
+    uint32_t changes_count = 0;
 
-                    found_improvement = true;
+    size_t checklist_pos = 0;
+    while (checklist_pos < checklist.size() && changes_count < MaxChanges) {
+        auto a = checklist[checklist_pos++];
+        assert(a < instance.dimension_);
 
-                    dont_look_bits.clear_bit(at_i);
-                    dont_look_bits.clear_bit(at_i_1);
+        changed_nodes.clear();
+        if (three_opt_move_at(instance, distance, tour, a, nn_count, changed_nodes) != 0) {
+            for (auto node : changed_nodes) {
+                push_to_checklist(checklist, checklist_pos, node);
+            }
+            ++changes_count;
+        }
+    }
+    return changes_count;
+}
 
-                    dont_look_bits.clear_bit(at_j);
-                    dont_look_bits.clear_bit(at_j_1);
 
-                    ++two_opt_changes;
+/*
+ * Tries to find an improving sequential move starting with the removal of
+ * edge (t1, t2), in the spirit of the Lin-Kernighan heuristic:
+ *
+ * Lin, Shen, and Brian W. Kernighan. "An effective heuristic algorithm for the
+ * traveling-salesman problem." Operations research 21.2 (1973): 498-516.
+ *
+ * The move is built step by step, each step is a 2-opt move which replaces
+ * edges (t1, t2) and (t3, t4) with (t2, t3) and (t4, t1), after which (t4, t1)
+ * becomes the edge to be removed in the next step. The best closed sequence
+ * is kept and the remaining steps are undone.
+ *
+ * Returns the gain (improvement) of the move, i.e. 0 if the tour was not
+ * changed. Endpoints of the new edges are appended to changed_nodes.
+ */
+template<typename Tour, typename Distance>
+double lk_move_at(const ProblemInstance &instance,
+                  const Distance &distance,
+                  Tour &tour,
+                  uint32_t t1, uint32_t t2,
+                  uint32_t nn_list_size,
+                  std::vector<uint32_t> &changed_nodes) {
+    // Limits the number of steps (2-opt moves) of a single move
+    const uint32_t MaxDepth = 12;
+    // Alternatives for t3 checked at the first step
+    const uint32_t MaxBreadth = 3;
+
+    auto same_edge = [](uint32_t a, uint32_t b, std::pair<uint32_t, uint32_t> e) {
+        return (e.first == a && e.second == b) || (e.first == b && e.second == a);
+    };
+
+    // Steps applied to the tour, each stored as (t2, t3, t4)
+    std::array<std::array<uint32_t, 3>, MaxDepth> steps;
+    std::array<std::pair<uint32_t, uint32_t>, MaxDepth> added;
+    std::array<std::pair<uint32_t, uint32_t>, MaxDepth + 1> removed;
+
+    const auto t1_t2_dist = distance(t1, t2);
+
+    for (uint32_t alternative = 0; alternative < MaxBreadth; ++alternative) {
+        uint32_t depth = 0;
+        uint32_t best_depth = 0;
+        double best_gain = 0;
+        // Sum of the removed minus the sum of the added edges' lengths,
+        // excluding the closing edge (t4, t1)
+        double gain = t1_t2_dist;
+        uint32_t last = t2;
+
+        removed[0] = { t1, t2 };
+
+        while (depth < MaxDepth) {
+            // We need the orientation in which t1 -> last
+            const bool forward = (tour.get_succ(t1) == last);
+            auto pred = [&](uint32_t node) { return forward ? tour.get_pred(node) : tour.get_succ(node); };
+            auto succ = [&](uint32_t node) { return forward ? tour.get_succ(node) : tour.get_pred(node); };
+
+            // Candidates for t3 are sorted by the gain after removing
+            // (t3, t4) so that we can select the k-th best at the first step
+            std::array<std::pair<double, uint32_t>, MaxBreadth> best_t3;
+            uint32_t best_t3_count = 0;
+            const uint32_t wanted = (depth == 0) ? alternative + 1 : 1;
+
+            const auto &last_nn_list = instance.get_ls_neighbors(last, nn_list_size);
+            const auto *last_nn_distances = instance.get_ls_nn_distances(last);
+            for (uint32_t j = 0; j < nn_list_size; ++j) {
+                const auto t3 = last_nn_list[j];
+                const auto dist_last_t3 = last_nn_distances[j];
+                if (dist_last_t3 >= gain) {
+                    break ;
+                }
+                if (t3 == t1 || t3 == succ(last)) {
+                    continue ;
+                }
+                const auto t4 = pred(t3);
 
+                bool is_tabu = false;
+                for (uint32_t k = 0; k < depth && !is_tabu; ++k) {
+                    is_tabu = same_edge(t3, t4, added[k]);
+                }
+                for (uint32_t k = 0; k <= depth && !is_tabu; ++k) {
+                    is_tabu = same_edge(last, t3, removed[k]);
+                }
+                if (is_tabu) {
                     continue ;
                 }
+                const auto value = distance(t3, t4) - dist_last_t3;
+
+                // Keep the list of the best candidates sorted
+                if (best_t3_count < wanted || value > best_t3[best_t3_count - 1].first) {
+                    uint32_t k = std::min(best_t3_count, wanted - 1);
+                    while (k > 0 && best_t3[k - 1].first < value) {
+                        best_t3[k] = best_t3[k - 1];
+                        --k;
+                    }
+                    best_t3[k] = { value, t3 };
+                    best_t3_count = std::min(best_t3_count + 1, wanted);
+                }
+            }
+            if (best_t3_count < wanted) {
+                if (depth == 0) {  // No more alternatives left
+                    return 0;
+                }
+                break ;
+            }
+            const auto t3 = best_t3[wanted - 1].second;
+            const auto t4 = pred(t3);
+
+            // Replaces (t1, last) and (t4, t3) with (last, t3) and (t1, t4)
+            tour.flip(last, t1, t3, t4);
+
+            gain += best_t3[wanted - 1].first;
+            added[depth] = { last, t3 };
+            removed[depth + 1] = { t3, t4 };
+            steps[depth] = { last, t3, t4 };
+            ++depth;
+
+            const auto closed_gain = gain - distance(t4, t1);
+            if (closed_gain > best_gain) {
+                best_gain = closed_gain;
+                best_depth = depth;
+            }
+            last = t4;
+        }
 
-                const auto &j_nn_list = instance.get_nearest_neighbors(at_j, nn_count);
+        // Undo the steps which did not improve the tour
+        while (depth > best_depth) {
+            --depth;
+            const auto &step = steps[depth];
+            tour.flip(t1, step[2], step[0], step[1]);
+        }
 
-                assert(at_i != at_j);  // These two should be different
+        if (best_depth > 0) {
+            tour.cost_ -= best_gain;
+            changed_nodes.push_back(t1);
+            for (uint32_t k = 0; k < best_depth; ++k) {
+                changed_nodes.insert(changed_nodes.end(), steps[k].begin(), steps[k].end());
+            }
+            return best_gain;
+        }
+    }
+    return 0;
+}
 
-                for (auto j_nn_idx = 0u; j_nn_idx < nn_count && !found_improvement ; ++j_nn_idx) {
-                    const auto at_k = j_nn_list[j_nn_idx];
-                    const auto k = pos_in_route[at_k];
 
-                    if (k == len || k == i) {  // Unlikely but possible, we want at_i != at_j != at_k
-                        continue ;
-                    }
+/**
+ * This is an implementation of a variable-depth local search based on the
+ * Lin-Kernighan heuristic in which every move is a sequence of 2-opt moves.
+ * Similarly to the two_opt_nn, the nodes from the checklist are used as
+ * starting points and the search is limited to the nearest neighbors.
+ *
+ * Returns a number of changes (moves) applied to the tour.
+ */
+template<typename Tour, typename Distance>
+int64_t lk_nn(const ProblemInstance &instance,
+              const Distance &distance,
+              Tour &tour,
+              std::vector<uint32_t> &checklist,
+              uint32_t nn_list_size) {
 
-                    uint32_t x = i;
-                    uint32_t y = j;
-                    uint32_t z = k;
-                    uint32_t at_x = at_i;
-                    uint32_t at_y = at_j;
-                    uint32_t at_z = at_k;
-
-                    // Sort (x, y, z)
-                    if (x > y) { swap(x, y); swap(at_x, at_y); }
-                    if (x > z) { swap(x, z); swap(at_x, at_z); }
-                    if (y > z) { swap(y, z); swap(at_y, at_z); }
-
-                    const auto x_1 = (x + 1) % len;
-                    const auto y_1 = (y + 1) % len;
-                    const auto z_1 = (z + 1) % len;
-
-                    const auto at_x_1 = route[x_1];
-                    const auto at_y_1 = route[y_1];
-                    const auto at_z_1 = route[z_1];
-
-                    const auto curr = instance.get_distance(at_x, at_x_1)
-                                    + instance.get_distance(at_y, at_y_1)
-                                    + instance.get_distance(at_z, at_z_1);
-
-                    // 4 sets of possible new edges to check
-                    const array<pair<uint32_t, uint32_t>, 4 * 3> edges{{
-                        { at_y, at_x   }, { at_z_1, at_y_1 }, {   at_z, at_x_1 },
-                        { at_y, at_z_1 }, {   at_x, at_y_1 }, {   at_z, at_x_1 },
-                        { at_y, at_z_1 }, {   at_x, at_z   }, { at_y_1, at_x_1 },
-                        { at_y, at_z   }, { at_y_1, at_x   }, { at_z_1, at_x_1 }
-                    }};
-
-                    // Which segments do we need to reverse in order to transform
-                    // route so that the new edges are created properly
-                    const array<bool, 4 * 3> segment_reversals{{
-                        false, true, true,
-                        true, true, true,
-                        true, true, false,
-                        true, false, true
-                    }};
-
-                    Segment seg[3] = {
-                        { z_1, x, len, 0 },
-                        { x_1, y, len, 1 },
-                        { y_1, z, len, 2 }
-                    };
-
-                    for (auto l = 0u; l < 4 * 3 && !found_improvement; l += 3) {
-                        auto e1 = edges[l + 0];
-                        auto e2 = edges[l + 1];
-                        auto e3 = edges[l + 2];
-
-                        const auto cost = instance.get_distance(e1.first, e1.second)
-                                        + instance.get_distance(e2.first, e2.second)
-                                        + instance.get_distance(e3.first, e3.second);
-
-
-                        if (cost < curr) {
-                            found_improvement = true;
-
-                            if (segment_reversals[l + 0]) {
-                                seg[0].reverse();
-                            }
-                            if (segment_reversals[l + 1]) {
-                                seg[1].reverse();
-                            }
-                            if (segment_reversals[l + 2]) {
-                                seg[2].reverse();
-                            }
-                            dont_look_bits.clear_bit(e1.first);
-                            dont_look_bits.clear_bit(e1.second);
-
-                            dont_look_bits.clear_bit(e2.first);
-                            dont_look_bits.clear_bit(e2.second);
-
-                            dont_look_bits.clear_bit(e3.first);
-                            dont_look_bits.clear_bit(e3.second);
-
-                            ++three_opt_changes;
-                        }
-                    }
-                    if (found_improvement) {
-                        perform_3_opt_move(route, seg[0], seg[1], seg[2]);
-                    }
-                }
+    // We assume symmetry so that the order of the nodes does not matter
+    assert(instance.is_symmetric_);
+
+    const auto route_size = instance.dimension_;
+    if (route_size < 8) {
+        return two_opt_nn(instance, distance, tour, checklist, nn_list_size);
+    }
+
+    std::vector<uint32_t> changed_nodes;
+
+    // Setting maximum number of allowed route changes prevents very long-running times
+    // for very hard to solve TSP instances.
+    const uint32_t MaxChanges = route_size;
+    uint32_t changes_count = 0;
+
+    size_t checklist_pos = 0;
+    while (checklist_pos < checklist.size() && changes_count < MaxChanges) {
+        auto t1 = checklist[checklist_pos++];
+        assert(t1 < instance.dimension_);
+
+        changed_nodes.clear();
+        for (auto t2 : { tour.get_succ(t1), tour.get_pred(t1) }) {
+            if (lk_move_at(instance, distance, tour, t1, t2, nn_list_size, changed_nodes) > 0) {
+                break ;
             }
-            if (!found_improvement && use_dont_look_bits) {
-                dont_look_bits.set_bit(at_i);
+        }
+        if (!changed_nodes.empty()) {
+            for (auto node : changed_nodes) {
+                push_to_checklist(checklist, checklist_pos, node);
             }
+            ++changes_count;
         }
-    } while(found_improvement);
+    }
+    return changes_count;
+}
 
-    return two_opt_changes + three_opt_changes;
+
+LocalSearchType get_local_search_type(const std::string &name) {
+    if (name == "2opt") {
+        return TWO_OPT;
+    }
+    if (name == "3opt") {
+        return THREE_OPT;
+    }
+    if (name == "oropt") {
+        return OR_OPT;
+    }
+    if (name == "lk") {
+        return LIN_KERNIGHAN;
+    }
+    throw std::runtime_error("Unknown local search type: " + name);
+}
+
+
+TourType get_tour_type(const std::string &name) {
+    if (name == "array") {
+        return ARRAY_TOUR;
+    }
+    if (name == "2level") {
+        return TWO_LEVEL_LIST_TOUR;
+    }
+    if (name == "tree") {
+        return TREE_TOUR;
+    }
+    throw std::runtime_error("Unknown tour type: " + name);
+}
+
+
+/*
+ * The public versions of the heuristics select the distance functor
+ * matching the instance once and call the versions specialized for it.
+ */
+
+int64_t two_opt_nn(const ProblemInstance &instance,
+                   std::vector<uint32_t> &route,
+                   bool use_dont_look_bits,
+                   uint32_t nn_count) {
+    return instance.with_metric([&](const auto &distance) {
+        return two_opt_nn(instance, distance, route, use_dont_look_bits, nn_count);
+    });
+}
+
+
+int64_t three_opt_nn(const ProblemInstance &instance,
+                     std::vector<uint32_t> &sol,
+                     bool use_dont_look_bits,
+                     uint32_t nn_count) {
+    return instance.with_metric([&](const auto &distance) {
+        return three_opt_nn(instance, distance, sol, use_dont_look_bits, nn_count);
+    });
+}
+
+
+template<typename Tour>
+int64_t two_opt_nn(const ProblemInstance &instance,
+                   Tour &tour,
+                   std::vector<uint32_t> &checklist,
+                   uint32_t nn_list_size) {
+    return instance.with_metric([&](const auto &distance) {
+        return two_opt_nn(instance, distance, tour, checklist, nn_list_size);
+    });
+}
+
+
+int64_t two_opt_nn(const ProblemInstance &instance,
+                   std::vector<uint32_t> &route,
+                   std::vector<uint32_t> &checklist,
+                   uint32_t nn_list_size) {
+    Solution tour(route, 0);
+    auto changes_count = two_opt_nn(instance, tour, checklist, nn_list_size);
+    route = tour.route_;
+    assert(instance.is_route_valid(route));
+    return changes_count;
+}
+
+
+template<typename Tour>
+int64_t or_opt_nn(const ProblemInstance &instance,
+                  Tour &tour,
+                  std::vector<uint32_t> &checklist,
+                  uint32_t nn_list_size) {
+    return instance.with_metric([&](const auto &distance) {
+        return or_opt_nn(instance, distance, tour, checklist, nn_list_size);
+    });
+}
+
+
+template<typename Tour>
+int64_t three_opt_nn(const ProblemInstance &instance,
+                     Tour &tour,
+                     std::vector<uint32_t> &checklist,
+                     uint32_t nn_count) {
+    return instance.with_metric([&](const auto &distance) {
+        return three_opt_nn(instance, distance, tour, checklist, nn_count);
+    });
 }
+
+
+template<typename Tour>
+int64_t lk_nn(const ProblemInstance &instance,
+              Tour &tour,
+              std::vector<uint32_t> &checklist,
+              uint32_t nn_list_size) {
+    return instance.with_metric([&](const auto &distance) {
+        return lk_nn(instance, distance, tour, checklist, nn_list_size);
+    });
+}
+
+
+template<typename Tour>
+int64_t local_search(const ProblemInstance &instance,
+                     LocalSearchType type,
+                     Tour &tour,
+                     std::vector<uint32_t> &checklist,
+                     uint32_t nn_list_size) {
+    return instance.with_metric([&](const auto &distance) -> int64_t {
+        switch (type) {
+            case THREE_OPT:
+                return three_opt_nn(instance, distance, tour, checklist, nn_list_size);
+            case OR_OPT:
+                return two_opt_nn(instance, distance, tour, checklist, nn_list_size)
+                     + or_opt_nn(instance, distance, tour, checklist, nn_list_size);
+            case LIN_KERNIGHAN:
+                return lk_nn(instance, distance, tour, checklist, nn_list_size);
+            default:
+                return two_opt_nn(instance, distance, tour, checklist, nn_list_size);
+        }
+    });
+}
+
+
+#define INSTANTIATE_LOCAL_SEARCH(Tour) \
+    template int64_t local_search(const ProblemInstance &, LocalSearchType, Tour &, \
+                                  std::vector<uint32_t> &, uint32_t); \
+    template int64_t two_opt_nn(const ProblemInstance &, Tour &, \
+                                std::vector<uint32_t> &, uint32_t); \
+    template int64_t or_opt_nn(const ProblemInstance &, Tour &, \
+                               std::vector<uint32_t> &, uint32_t); \
+    template int64_t three_opt_nn(const ProblemInstance &, Tour &, \
+                                  std::vector<uint32_t> &, uint32_t); \
+    template int64_t lk_nn(const ProblemInstance &, Tour &, \
+                           std::vector<uint32_t> &, uint32_t);
+
+INSTANTIATE_LOCAL_SEARCH(Solution)
+INSTANTIATE_LOCAL_SEARCH(DoubleLinkedListSolution)
+INSTANTIATE_LOCAL_SEARCH(TreeSolution)
@@ -1,8 +1,71 @@
 #pragma once
 
+#include <string>
 #include <vector>
 #include "problem_instance.h"
 
+// Local search heuristics which can be applied to the solutions
+enum LocalSearchType { TWO_OPT, THREE_OPT, OR_OPT, LIN_KERNIGHAN };
+
+/**
+ * Returns the type of the local search with the given name, i.e. one of:
+ * 2opt, 3opt, oropt or lk.
+ *
+ * Throws runtime_error if the name is unknown.
+ */
+LocalSearchType get_local_search_type(const std::string &name);
+
+// Tour representations which can be used by the local search
+enum TourType { ARRAY_TOUR, TWO_LEVEL_LIST_TOUR, TREE_TOUR };
+
+/**
+ * Returns the type of the tour representation with the given name, i.e. one
+ * of: array, 2level or tree.
+ *
+ * Throws runtime_error if the name is unknown.
+ */
+TourType get_tour_type(const std::string &name);
+
+/*
+ * This performs a 2-opt move by flipping a section of the route.
+ * The boundaries of the section are given by first and last, i.e. the
+ * section [first, last) is reversed. The positions of the nodes inside the
+ * route are also updated to match the order after the flip.
+ */
+void flip_route_section(std::vector<uint32_t> &route,
+                        std::vector<uint32_t> &pos_in_route,
+                        int32_t first, int32_t last);
+
+/*
+ * The local search heuristics working with a checklist are implemented for
+ * any Tour type providing the following methods:
+ *
+ * - get_succ(node), get_pred(node) -- neighbors of the node in the tour,
+ * - between(a, b, c) -- true if b lies on the path going from a to c,
+ * - flip(t1, t2, t3, t4) -- a 2-opt move which replaces edges (t1, t2) and
+ *   (t3, t4) with (t1, t3) and (t2, t4),
+ *
+ * and a cost_ member which is decreased by the gain of every applied move.
+ *
+ * These are explicitly instantiated for Solution (array representation),
+ * DoubleLinkedListSolution (two-level doubly-linked list) and TreeSolution
+ * (balanced binary tree).
+ */
+
+/**
+ * Applies the local search of the given type to the tour. Only the nodes from
+ * the checklist are used as starting points when looking for an improving
+ * move. The OR_OPT type corresponds to 2-opt followed by Or-opt.
+ *
+ * Returns a number of changes (moves) applied to the tour.
+ */
+template<typename Tour>
+int64_t local_search(const ProblemInstance &instance,
+                     LocalSearchType type,
+                     Tour &tour,
+                     std::vector<uint32_t> &checklist,
+                     uint32_t nn_list_size);
+
 /**
  * This is an implementation of an approximate 2-opt heuristic which uses the
  * nearest neighbor lists to limit the search for an improving move.
@@ -17,6 +80,25 @@ int64_t two_opt_nn(const ProblemInstance &instance,
                    std::vector<uint32_t> &check_queue,
                    uint32_t nn_count);
 
+template<typename Tour>
+int64_t two_opt_nn(const ProblemInstance &instance,
+                   Tour &tour,
+                   std::vector<uint32_t> &checklist,
+                   uint32_t nn_list_size);
+
+/**
+ * This is an implementation of the Or-opt heuristic which moves segments of up
+ * to 3 consecutive nodes (starting at the nodes from the checklist) into a
+ * better place in the tour. The search is limited to the nearest neighbors.
+ *
+ * Returns a number of changes (moves) applied to the tour.
+ */
+template<typename Tour>
+int64_t or_opt_nn(const ProblemInstance &instance,
+                  Tour &tour,
+                  std::vector<uint32_t> &checklist,
+                  uint32_t nn_list_size);
+
 /*
  * Impl. of the 3-opt heuristic. Tries to change the order of nodes in
  * solution to shorten the travel distance.
@@ -39,3 +121,29 @@ int64_t three_opt_nn(const ProblemInstance &instance,
                      std::vector<uint32_t> &sol,
                      bool use_dont_look_bits,
                      uint32_t nn_count);
+
+/*
+ * This impl. of the 3-opt heuristic uses a checklist of nodes to check for an
+ * improving move, similarly to the two_opt_nn.
+ *
+ * Returns a number of changes (moves) applied to the tour.
+ */
+template<typename Tour>
+int64_t three_opt_nn(const ProblemInstance &instance,
+                     Tour &tour,
+                     std::vector<uint32_t> &checklist,
+                     uint32_t nn_count);
+
+/**
+ * This is an implementation of a variable-depth local search based on the
+ * Lin-Kernighan heuristic, in which every move is built from a sequence of
+ * 2-opt moves. The nodes from the checklist are used as starting points and
+ * the search is limited to the nearest neighbors.
+ *
+ * Returns a number of changes (moves) applied to the tour.
+ */
+template<typename Tour>
+int64_t lk_nn(const ProblemInstance &instance,
+              Tour &tour,
+              std::vector<uint32_t> &checklist,
+              uint32_t nn_list_size);
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/*
+ * Read-only view of a whole file mapped into memory. The file is unmapped
+ * when the object is destroyed.
+ *
+ * Throws runtime_error if the file cannot be opened or is empty.
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const char *path) {
+        const auto fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error(std::string("Cannot open file: ") + path);
+        }
+        struct stat file_stat {};
+        if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+            size_ = static_cast<size_t>(file_stat.st_size);
+            void *addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                data_ = static_cast<const char *>(addr);
+                madvise(addr, size_, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
+        if (data_ == nullptr) {
+            throw std::runtime_error(std::string("Cannot read file: ") + path);
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile() {
+        munmap(const_cast<char *>(data_), size_);
+    }
+
+    [[nodiscard]] const char *data() const { return data_; }
+
+    [[nodiscard]] size_t size() const { return size_; }
+
+    [[nodiscard]] std::string_view get_text() const { return { data_, size_ }; }
+
+private:
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+};
@@ -5,6 +5,7 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <limits>
 #include <vector>
 #include <cassert>
 
@@ -12,30 +13,125 @@
 #include <iostream>
 
 
+/*
+ * Applies the evaporation of the pheromone trails lazily. Instead of updating
+ * every trail in each iteration, a trail stores its value together with the
+ * number of the evaporation step (iteration) in which the value was set. The
+ * pending steps are applied when the trail is read.
+ *
+ * A single step changes value v into max(min, v * (1 - rate) + delta). If f
+ * denotes the step without the max, k steps result in max(min, f^k(v)) as
+ * long as the rate and delta do not change and min does not decrease. The
+ * f^k(v) = a^k * v + delta * (1 + a + ... + a^(k-1)), where a = 1 - rate,
+ * is computed in O(1) time using precomputed tables. If the parameters
+ * change, the trails have to be updated first (see needs_materialization).
+ */
+class LazyEvaporation {
+public:
+    // a^k below this is treated as 0, i.e. the trail has fully evaporated
+    static constexpr double MinFactor = 1e-16;
+
+    uint32_t iteration_ = 0;  // # of the evaporation steps performed
+
+    [[nodiscard]] double get(double value, uint32_t stamp) const {
+        return apply_steps(value, iteration_ - stamp);
+    }
+
+    // Returns the value the trail had before the last step, the trail has to
+    // be set before that step
+    [[nodiscard]] double get_previous(double value, uint32_t stamp) const {
+        assert(stamp < iteration_);
+        return apply_steps(value, iteration_ - stamp - 1);
+    }
+
+    [[nodiscard]] double get_min_value() const { return min_value_; }
+
+    // Returns true if the trails have to be updated (materialized) before
+    // performing a step with the given parameters
+    [[nodiscard]] bool needs_materialization(double evaporation_rate,
+                                             double min_pheromone_value,
+                                             double delta) const {
+        return iteration_ != base_iteration_
+            && (evaporation_rate != evaporation_rate_
+                || delta != delta_
+                || min_pheromone_value < min_value_);
+    }
+
+    void step(double evaporation_rate, double min_pheromone_value, double delta) {
+        if (evaporation_rate != evaporation_rate_ || delta != delta_
+                || iteration_ == base_iteration_) {
+            // All of the trails are up to date, start with the new parameters
+            evaporation_rate_ = evaporation_rate;
+            delta_ = delta;
+            base_iteration_ = iteration_;
+            factors_.assign(1, 1.0);
+            offsets_.assign(1, 0.0);
+        }
+        min_value_ = min_pheromone_value;
+        ++iteration_;
+
+        // The tables have to cover the steps since the oldest possible stamp
+        if (factors_.size() <= iteration_ - base_iteration_
+                && factors_.back() >= MinFactor) {
+            factors_.push_back(factors_.back() * (1 - evaporation_rate_));
+            offsets_.push_back(offsets_.back() * (1 - evaporation_rate_) + delta_);
+        }
+    }
+
+private:
+    [[nodiscard]] double apply_steps(double value, uint32_t steps) const {
+        if (steps == 0) {
+            return value;
+        }
+        const auto k = std::min<size_t>(steps, factors_.size() - 1);
+        return std::max(min_value_, factors_[k] * value + offsets_[k]);
+    }
+
+    double evaporation_rate_ = 0;
+    double delta_ = 0;
+    double min_value_ = 0;
+    uint32_t base_iteration_ = 0;  // When the current parameters were set
+    std::vector<double> factors_ { 1.0 };  // factors_[k] = a^k
+    std::vector<double> offsets_ { 0.0 };  // offsets_[k] = f^k(0)
+};
+
+
 struct MatrixPheromone {
     uint32_t dimension_ = 0;
     std::vector<double> trails_; // For every edge (a,b),
                                  // where 0 <= a, b < dimension_
+    std::vector<uint32_t> stamps_;  // When the trails were last updated
     bool is_symmetric_ = true;
+    LazyEvaporation evaporation_;
 
     MatrixPheromone(uint32_t dimension, double initial_pheromone, bool is_symmetric)
         : dimension_(dimension),
           trails_(dimension * dimension, initial_pheromone),
+          stamps_(dimension * dimension, 0),
           is_symmetric_(is_symmetric) {
     }
 
     [[nodiscard]] double get(uint32_t from, uint32_t to) const {
         assert((from < dimension_) && (to < dimension_));
-        return trails_[from * dimension_ + to];
+        const auto i = from * dimension_ + to;
+        return evaporation_.get(trails_[i], stamps_[i]);
     }
 
+    // Has to be called by all threads of the parallel region
     void evaporate(double evaporation_rate, double min_pheromone_value, double delta = 0.0) {
-        const auto n = trails_.size();
+        if (evaporation_.needs_materialization(evaporation_rate, min_pheromone_value, delta)) {
+            const auto n = trails_.size();
 
-        #pragma omp for schedule(static)
-        for (size_t i = 0; i < n; ++i) {
-            trails_[i] = std::max(min_pheromone_value, trails_[i] * (1 - evaporation_rate) + delta);
+            #pragma omp for schedule(static)
+            for (size_t i = 0; i < n; ++i) {
+                trails_[i] = evaporation_.get(trails_[i], stamps_[i]);
+                stamps_[i] = evaporation_.iteration_;
+            }
         }
+        // Every thread has to check the condition before it changes
+        #pragma omp barrier
+        #pragma omp single
+        evaporation_.step(evaporation_rate, min_pheromone_value, delta);
     }
 
     void increase(uint32_t from, uint32_t to, double deposit,
@@ -43,21 +139,54 @@ struct MatrixPheromone {
 
         assert((from < dimension_) && (to < dimension_));
 
-        auto &value = trails_[from * dimension_ + to];
-        value = std::min(max_pheromone_value, value + deposit);
+        const auto i = from * dimension_ + to;
+        trails_[i] = std::min(max_pheromone_value,
+                              evaporation_.get(trails_[i], stamps_[i]) + deposit);
+        stamps_[i] = evaporation_.iteration_;
 
         if (is_symmetric_) {
-            trails_[to * dimension_ + from] = value;
+            trails_[to * dimension_ + from] = trails_[i];
+            stamps_[to * dimension_ + from] = stamps_[i];
         }
     }
 };
 
 
-// Pheromone values are stored only for the nodes which are on candidate lists
+/*
+ * Pheromone values are stored only for the nodes which are on candidate lists
+ *
+ * The trails of a node (a row) are usually the same in consecutive iterations
+ * -- they are either at the min. value, or are kept at the max. value by the
+ * deposits. The structure tracks which rows might have changed so that the
+ * values derived from them (e.g. products with the heuristic) have to be
+ * recomputed only for these rows, see is_row_changed.
+ *
+ * The trails are stored as Trail_t values (double or float) but all the
+ * computations are done in double precision.
+ */
+template<typename Trail_t = double>
 struct CandListPheromone {
-    // We store cl_size_ trails for every node but serialized
+    static constexpr uint32_t NoSlot = std::numeric_limits<uint32_t>::max();
+
+    // We store cl_size_ trails for every node but serialized, a position in
+    // these is called a slot
     std::vector<uint32_t> nodes_;  // neighboring nodes
-    std::vector<double>   trails_; // corresponding pheromone trails
+    std::vector<Trail_t>  trails_; // corresponding pheromone trails
+    // For the slot of edge (a, b) this is the slot of edge (b, a), or NoSlot
+    // if a is not on the candidate list of b
+    std::vector<uint32_t> reverse_slots_;
+    std::vector<uint32_t> stamps_; // when the trails were last updated
+    LazyEvaporation evaporation_;
+
+    struct RowState {
+        uint32_t checked_at_ = 0;     // Evaporation step of the last refresh_row
+        uint32_t deposited_at_ = 0;   // Evaporation step of the deposited_mask_
+        uint32_t above_min_mask_ = 0; // Trails above the min. value when checked
+        uint32_t deposited_mask_ = 0; // Trails which got back their values by a deposit
+        bool changed_ = true;         // Was any trail changed by a deposit?
+    };
+    std::vector<RowState> rows_;
+    uint32_t min_changed_at_ = 0;     // Evaporation step in which the min. value changed
 
     uint32_t dimension_ = 0;
     uint32_t cl_size_ = 0;
@@ -73,77 +202,175 @@ struct CandListPheromone {
           is_symmetric_(is_symmetric),
           default_pheromone_value_(initial_pheromone)
     {
-        trails_.resize(dimension_ * cl_size_, initial_pheromone);
+        assert(cl_size_ <= 32);  // For the masks in RowState
+        trails_.resize(dimension_ * cl_size_, static_cast<Trail_t>(initial_pheromone));
+        stamps_.resize(dimension_ * cl_size_, 0);
+        rows_.resize(dimension_);
         for (auto &list : cand_lists) {
             assert(list.size() == cl_size_);
             for (auto &node : list) {
                 nodes_.push_back(node);
             }
         }
+        reverse_slots_.resize(nodes_.size());
+        for (uint32_t from = 0; from < dimension_; ++from) {
+            for (uint32_t j = 0; j < cl_size_; ++j) {
+                const auto slot = from * cl_size_ + j;
+                reverse_slots_[slot] = find_slot(nodes_[slot], from);
+            }
+        }
     }
 
-    [[nodiscard]] double get(uint32_t from, uint32_t to) const {
+    // Returns the slot of edge (from, to) or NoSlot if to is not on the
+    // candidate list of from
+    [[nodiscard]] uint32_t find_slot(uint32_t from, uint32_t to) const {
         assert((from < dimension_) && (to < dimension_));
 
         auto offset = from * cl_size_;
         for (uint32_t i = offset; i < offset + cl_size_; ++i) {
             if (nodes_[i] == to) {
-                return trails_[i];
+                return i;
             }
         }
-        return default_pheromone_value_;
+        return NoSlot;
     }
 
-    void increase_helper(uint32_t from, uint32_t to,
-                         double deposit,
-                         double max_pheromone_value) {
-        assert((from < dimension_) && (to < dimension_));
+    [[nodiscard]] double get(uint32_t from, uint32_t to) const {
+        const auto slot = find_slot(from, to);
+        return (slot != NoSlot) ? get_trail(slot) : default_pheromone_value_;
+    }
 
-        auto offset = from * cl_size_;
-        for (uint32_t i = offset; i < offset + cl_size_; ++i) {
-            if (nodes_[i] == to) {
-                trails_[i] = std::min(max_pheromone_value, deposit + trails_[i]);
-                break ;
+    // Returns the trail at the given slot
+    [[nodiscard]] double get_trail(uint32_t slot) const {
+        return evaporation_.get(trails_[slot], stamps_[slot]);
+    }
+
+    // Returns the trail of the edge connecting the node with its j-th
+    // candidate
+    [[nodiscard]] double get_row_trail(uint32_t node, uint32_t j) const {
+        assert(j < cl_size_);
+        return get_trail(node * cl_size_ + j);
+    }
+
+    void increase_at(uint32_t slot, double deposit, double max_pheromone_value) {
+        const auto value = static_cast<Trail_t>(std::min(max_pheromone_value, deposit + get_trail(slot)));
+        auto &row = rows_[slot / cl_size_];
+        // The deposit can restore the value the trail had before the last
+        // evaporation step, e.g. the max. value
+        if (stamps_[slot] < evaporation_.iteration_
+                && value == evaporation_.get_previous(trails_[slot], stamps_[slot])) {
+            if (row.deposited_at_ != evaporation_.iteration_) {
+                row.deposited_at_ = evaporation_.iteration_;
+                row.deposited_mask_ = 0;
             }
+            row.deposited_mask_ |= 1u << (slot % cl_size_);
+        } else {
+            row.changed_ = true;
+        }
+        trails_[slot] = value;
+        stamps_[slot] = evaporation_.iteration_;
+    }
+
+    /*
+     * Returns true if the trails of the node (row) could have changed since
+     * the last call to refresh_row(node) -- a trail was changed by a
+     * deposit, the min. value changed, or one of the trails above the min.
+     * value evaporated (i.e. it was not restored by a deposit). This assumes
+     * that the row was checked at least once per evaporation step.
+     */
+    [[nodiscard]] bool is_row_changed(uint32_t node) const {
+        const auto &row = rows_[node];
+        if (row.changed_ || row.checked_at_ < min_changed_at_) {
+            return true;
+        }
+        if (row.checked_at_ == evaporation_.iteration_) {
+            return false;
         }
+        const auto deposited = (row.deposited_at_ == evaporation_.iteration_)
+                             ? row.deposited_mask_ : 0u;
+        return (row.above_min_mask_ & ~deposited) != 0;
     }
 
+    /*
+     * Calls fn(j, trail) for every trail of the node's row, where j is the
+     * position of the corresponding neighbor on the candidate list, and
+     * marks the row as unchanged.
+     */
+    template<typename Fn>
+    void refresh_row(uint32_t node, Fn fn) {
+        auto &row = rows_[node];
+        const auto offset = node * cl_size_;
+        const auto min_value = evaporation_.get_min_value();
+        row.above_min_mask_ = 0;
+        for (uint32_t j = 0; j < cl_size_; ++j) {
+            const auto trail = get_trail(offset + j);
+            fn(j, trail);
+            row.above_min_mask_ |= static_cast<uint32_t>(trail > min_value) << j;
+        }
+        row.checked_at_ = evaporation_.iteration_;
+        row.changed_ = false;
+    }
     void increase(uint32_t from, uint32_t to,
                   double delta,
                   double max_pheromone_value) {
 
-        increase_helper(from, to, delta, max_pheromone_value);
-        if (is_symmetric_) {
-            increase_helper(to, from, delta, max_pheromone_value);
+        const auto slot = find_slot(from, to);
+        if (slot != NoSlot) {
+            increase_at(slot, delta, max_pheromone_value);
+            if (is_symmetric_ && reverse_slots_[slot] != NoSlot) {
+                increase_at(reverse_slots_[slot], delta, max_pheromone_value);
+            }
+        } else if (is_symmetric_) {  // from can still be a candidate of to
+            const auto reverse_slot = find_slot(to, from);
+            if (reverse_slot != NoSlot) {
+                increase_at(reverse_slot, delta, max_pheromone_value);
+            }
         }
     }
 
+    // Has to be called by all threads of the parallel region
     void evaporate(double evaporation_rate, double min_pheromone_value, double delta = 0.0) {
-        const auto n = trails_.size();
+        if (evaporation_.needs_materialization(evaporation_rate, min_pheromone_value, delta)) {
+            const auto n = trails_.size();
 
-        #pragma omp for schedule(static)
-        for (size_t i = 0; i < n; ++i) {
-            trails_[i] = std::max(min_pheromone_value, trails_[i] * (1 - evaporation_rate) + delta);
+            #pragma omp for schedule(static)
+            for (size_t i = 0; i < n; ++i) {
+                trails_[i] = static_cast<Trail_t>(get_trail(static_cast<uint32_t>(i)));
+                stamps_[i] = evaporation_.iteration_;
+            }
         }
-
+        // Every thread has to check the condition before it changes
+        #pragma omp barrier
         #pragma omp single
-        default_pheromone_value_ = std::max(default_pheromone_value_ * (1 - evaporation_rate) + delta,
-                                            min_pheromone_value);
+        {
+            if (min_pheromone_value != evaporation_.get_min_value()) {
+                min_changed_at_ = evaporation_.iteration_ + 1;
+            }
+            evaporation_.step(evaporation_rate, min_pheromone_value, delta);
+            default_pheromone_value_ = std::max(default_pheromone_value_ * (1 - evaporation_rate) + delta,
+                                                min_pheromone_value);
+        }
     }
 
     void set_all_trails(double pheromone_value) {
         for (auto &t : trails_) {
-            t = pheromone_value;
+            t = static_cast<Trail_t>(pheromone_value);
+        }
+        std::fill(stamps_.begin(), stamps_.end(), evaporation_.iteration_);
+        for (auto &row : rows_) {
+            row.changed_ = true;
         }
     }
 
     void print_stats() {
         std::vector<double> ratios;
+        std::vector<double> row(cl_size_);
         for (uint32_t node = 0; node < dimension_; ++node) {
-            auto low = *std::min_element(trails_.begin() + (node * cl_size_),
-                              trails_.begin() + ((node + 1) * cl_size_));
-            auto high = *std::max_element(trails_.begin() + (node * cl_size_),
-                              trails_.begin() + ((node + 1) * cl_size_));
+            for (uint32_t i = 0; i < cl_size_; ++i) {
+                row[i] = get_trail(node * cl_size_ + i);
+            }
+            auto low = *std::min_element(row.begin(), row.end());
+            auto high = *std::max_element(row.begin(), row.end());
             if (low > 0) {
                 ratios.push_back(high / low);
             }
@@ -3,11 +3,16 @@
  */
 #include <fstream>
 #include <iostream>
-#include <sstream>
 #include <algorithm> 
 #include <cctype>
+#include <charconv>
+#include <string_view>
+#include <omp.h>
+#include <numeric>
+#include <tuple>
 
 #include "problem_instance.h"
+#include "mapped_file.h"
 
 // This comes from https://stackoverflow.com/a/217605
 // trim from start (in place)
@@ -32,42 +37,181 @@ static inline void trim(std::string &s) {
     rtrim(s);
 }
 
+namespace {
+
+inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+
+// Returns the line starting at pos (without the end of line) and moves pos
+// to the beginning of the next line
+std::string_view get_line(std::string_view text, size_t &pos) {
+    const auto line_start = pos;
+    auto line_end = text.find('\n', pos);
+    if (line_end == std::string_view::npos) {
+        line_end = text.size();
+        pos = text.size();
+    } else {
+        pos = line_end + 1;
+    }
+    if (line_end > line_start && text[line_end - 1] == '\r') {
+        --line_end;
+    }
+    return text.substr(line_start, line_end - line_start);
+}
+
+
+/*
+ * Returns the position of the first line starting with a letter, e.g. with
+ * a keyword or "EOF", i.e. the end of a section of numbers starting at pos.
+ */
+size_t find_section_end(std::string_view text, size_t pos) {
+    while (pos < text.size()) {
+        const auto line_start = pos;
+        const auto line = get_line(text, pos);
+        for (auto c : line) {
+            if (!is_space(c)) {
+                if (std::isalpha(static_cast<unsigned char>(c))) {
+                    return line_start;
+                }
+                break ;
+            }
+        }
+    }
+    return text.size();
+}
+
+
+/*
+ * Parses (at most max_count) whitespace-separated numbers from the text.
+ * The text is split into chunks at whitespace, which are parsed in parallel
+ * -- first the numbers in each chunk are counted, so that every chunk knows
+ * where to store its values.
+ *
+ * Throws runtime_error if a token is not a valid number.
+ */
+void parse_numbers(std::string_view text, size_t max_count, std::vector<double> &values) {
+    using namespace std;
+
+    // Small sections are not worth splitting
+    const size_t MinChunkSize = 1 << 16;
+    const auto chunks_count = static_cast<uint32_t>(clamp<size_t>(
+        text.size() / MinChunkSize, 1, static_cast<size_t>(omp_get_max_threads())));
+
+    vector<size_t> bounds(chunks_count + 1, text.size());
+    bounds[0] = 0;
+    for (uint32_t i = 1; i < chunks_count; ++i) {
+        auto pos = max(bounds[i - 1], text.size() * i / chunks_count);
+        while (pos < text.size() && !is_space(text[pos])) {
+            ++pos;
+        }
+        bounds[i] = pos;
+    }
+
+    auto for_each_token = [&text](size_t begin, size_t end, auto fn) {
+        auto pos = begin;
+        while (true) {
+            while (pos < end && is_space(text[pos])) {
+                ++pos;
+            }
+            if (pos == end) {
+                break ;
+            }
+            const auto token_start = pos;
+            while (pos < end && !is_space(text[pos])) {
+                ++pos;
+            }
+            if (!fn(token_start, pos)) {
+                break ;
+            }
+        }
+    };
+
+    vector<size_t> offsets(chunks_count + 1, 0);
+    #pragma omp parallel for default(none) shared(bounds, offsets, for_each_token, chunks_count)
+    for (uint32_t i = 0; i < chunks_count; ++i) {
+        size_t count = 0;
+        for_each_token(bounds[i], bounds[i + 1], [&count](size_t, size_t) { ++count; return true; });
+        offsets[i + 1] = count;
+    }
+    partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+    values.resize(min(offsets.back(), max_count));
+    bool is_valid = true;
+
+    #pragma omp parallel for default(none) \
+            shared(text, bounds, offsets, for_each_token, values, is_valid, chunks_count)
+    for (uint32_t i = 0; i < chunks_count; ++i) {
+        auto index = offsets[i];
+        for_each_token(bounds[i], bounds[i + 1], [&](size_t token_start, size_t token_end) {
+            if (index >= values.size()) {
+                return false;
+            }
+            const auto *first = text.data() + token_start;
+            const auto *last = text.data() + token_end;
+            if (*first == '+') {  // Not accepted by from_chars
+                ++first;
+            }
+            const auto [ptr, ec] = from_chars(first, last, values[index++]);
+            if (ec != errc() || ptr != last) {
+                #pragma omp atomic write
+                is_valid = false;
+                return false;
+            }
+            return true;
+        });
+    }
+    if (!is_valid) {
+        throw runtime_error("Invalid number in the TSP instance file");
+    }
+}
+
+}  // namespace
+
+
 /**
  * Tries to load a Traveling Salesman Problem (or ATSP) instance in TSPLIB
  * format from file at 'path'. Only the instances with 'EDGE_WEIGHT_TYPE:
  * EUC_2D' or 'EXPLICIT' are supported.
  *
+ * The file is mapped into memory and the sections with the coordinates or
+ * the edge weights are parsed in parallel. If verbose is true, the header
+ * lines are written to the standard output.
+ *
  * Throws runtime_error if the file is in unsupported format or if an error was
  * encountered.
  *
  * Returns the loaded problem instance.
  */
-ProblemInstance load_tsplib_instance(const char *path) {
+ProblemInstance load_tsplib_instance(const char *path, bool verbose) {
     using namespace std;
     enum EdgeWeightFormat { UPPER_DIAG_ROW, LOWER_DIAG_ROW, UPPER_ROW, FUNCTION };
 
-    ifstream in(path);
-
-    if (!in.is_open()) {
-        throw runtime_error(string("Cannot open TSP instance file: ") + path);
-    }
-
-    string line;
+    const MappedFile file(path);
+    const auto text = file.get_text();
 
     uint32_t dimension = 0;
     vector<double> distances;
     vector<Vec2d> coords;
+    vector<double> values;
     EdgeWeightType edge_weight_type{EUC_2D};
     EdgeWeightFormat edge_weight_format { UPPER_DIAG_ROW };
     bool is_symmetric = true;
     string name = "Unknown";
 
-    cout << "Loading TSP instance from file:" << path << "\n";
+    if (verbose) {
+        cout << "Loading TSP instance from file:" << path << "\n";
+    }
 
-    while (getline(in, line)) {
-        cout << '\t' << line << endl;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        const auto line = get_line(text, pos);
+        if (verbose) {
+            cout << '\t' << line << '\n';
+        }
         if (line.find("NAME") == 0) {
-            name = line.substr(line.find(':') + 1);
+            name = string(line.substr(line.find(':') + 1));
             trim(name);
         } else if (line.find("TYPE") == 0) {
             if (line.find(" TSP") != string::npos) {
@@ -78,8 +222,12 @@ ProblemInstance load_tsplib_instance(const char *path) {
                 throw runtime_error("Unknown problem type");
             }
         } else if (line.find("DIMENSION") != string::npos) {
-            istringstream line_in(line.substr(line.find(':') + 1));
-            if (!(line_in >> dimension)) {
+            auto value = line.substr(line.find(':') + 1);
+            while (!value.empty() && is_space(value.front())) {
+                value.remove_prefix(1);
+            }
+            const auto [ptr, ec] = from_chars(value.data(), value.data() + value.size(), dimension);
+            if (ec != errc()) {
                 throw runtime_error(string("Cannot read instance dimension"));
             }
         } else if (line.find("EDGE_WEIGHT_TYPE") != string::npos) {
@@ -109,100 +257,54 @@ ProblemInstance load_tsplib_instance(const char *path) {
                 throw runtime_error(string("Unsupported edge weight format"));
             }
         } else if (line.find("NODE_COORD_SECTION") != string::npos) {
-            while (coords.size() < dimension && getline(in, line)) {
-                if (line.find("EOF") != string::npos) {
-                    break ;
-                }
-                istringstream line_in(line);
-                uint32_t id;
-                Vec2d point {};
-                if (line_in >> id >> point.x_ >> point.y_) {
-                    coords.push_back(point);
-                } else {
-                    cerr << "Error while reading coordinates! A pair of floats was expected.";
-                    abort();  // We should not continue without checking the input file first
-                }
+            const auto section_end = find_section_end(text, pos);
+            // Each line holds: id x y
+            parse_numbers(text.substr(pos, section_end - pos), 3 * size_t{dimension}, values);
+            if (values.size() % 3 != 0) {
+                throw runtime_error("Error while reading coordinates! A pair of floats was expected.");
+            }
+            coords.resize(values.size() / 3);
+            for (size_t i = 0; i < coords.size(); ++i) {
+                coords[i] = { values[3 * i + 1], values[3 * i + 2] };
             }
+            pos = section_end;
         } else if (line.find("EDGE_WEIGHT_SECTION") != string::npos) {
             assert(dimension > 0);
             if (edge_weight_type != EXPLICIT) {
                 throw runtime_error("Expected EXPLICIT edge weight type");
             }
+            const size_t n = dimension;
+            const auto section_end = find_section_end(text, pos);
+            const auto expected = (edge_weight_format == UPPER_ROW) ? n * (n - 1) / 2
+                                : (edge_weight_format == FUNCTION)  ? n * n
+                                : n * (n + 1) / 2;
+            parse_numbers(text.substr(pos, section_end - pos), expected, values);
+            if (values.size() < expected) {
+                throw runtime_error("Too few edge weights in the TSP instance file");
+            }
+            pos = section_end;
 
-            if (edge_weight_format == UPPER_DIAG_ROW) {
-                distances.resize(dimension * dimension);
-
-                uint32_t row = 0;
-                uint32_t col = 0;
-                while (row < dimension && getline(in, line)) {
-                    istringstream line_in(line);
-                    double distance;
-                    while (line_in >> distance) {
-                        distances.at(row * dimension + col) = distance;
-                        distances.at(col * dimension + row) = distance;
-                        ++col;
-                        if (col == dimension) {
-                            ++row;
-                            col = row;
-                        }
-                    }
-                }
-            } else if (edge_weight_format == UPPER_ROW) {
-                distances.resize(dimension * dimension);
-
-                uint32_t row = 0;
-                uint32_t col = 1;
-                while (row < dimension && getline(in, line)) {
-                    istringstream line_in(line);
-                    double distance;
-                    while (line_in >> distance) {
-                        distances.at(row * dimension + col) = distance;
-                        distances.at(col * dimension + row) = distance;
-                        ++col;
-                        if (col == dimension) {
-                            ++row;
-                            col = row + 1;
-                        }
-                    }
-                }
-            } else if (edge_weight_format == LOWER_DIAG_ROW) {
-                distances.resize(dimension * dimension, 0);
-
-                uint32_t row = 0;
-                uint32_t col = 0;
-                while (row < dimension && getline(in, line)) {
-                    istringstream line_in(line);
-                    double distance;
-                    while (line_in >> distance) {
-                        distances.at(row * dimension + col) = distance;
-                        distances.at(col * dimension + row) = distance;
-                        ++col;
-                        if (col == row + 1) {
-                            ++row;
-                            col = 0;
-                            if (row == dimension) {
-                                break ;
-                            }
-                        }
-                    }
-                }
-            } else {
-                distances.reserve(dimension * dimension);
-                while (getline(in, line)) {
-                    if (line.find("EOF") != string::npos) {
-                        break;
-                    }
-                    istringstream line_in(line);
-                    double distance;
-                    while (line_in >> distance) {
-                        distances.push_back(distance);
-                    }
+            if (edge_weight_format == FUNCTION) {
+                distances = move(values);
+                continue ;
+            }
+            distances.assign(n * n, 0);
+            auto it = values.begin();
+            for (size_t row = 0; row < n; ++row) {
+                // The range of columns stored for the row
+                const auto first = (edge_weight_format == LOWER_DIAG_ROW) ? 0
+                                 : (edge_weight_format == UPPER_ROW) ? row + 1 : row;
+                const auto last = (edge_weight_format == LOWER_DIAG_ROW) ? row + 1 : n;
+                for (auto col = first; col < last; ++col, ++it) {
+                    distances[row * n + col] = *it;
+                    distances[col * n + row] = *it;
                 }
             }
-            assert(distances.size() == dimension * dimension);
         }
     }
-    in.close();
+    if (verbose) {
+        cout << flush;
+    }
 
     assert(dimension > 2);
 
@@ -213,6 +315,339 @@ ProblemInstance load_tsplib_instance(const char *path) {
 }
 
 
+namespace {
+
+/*
+ * Undirected graph made of the edges between the nodes and (some of) their
+ * nearest neighbors. The edges incident to a node are stored in the CSR
+ * format, i.e. incident_[offsets_[node] .. offsets_[node + 1]).
+ */
+struct SparseGraph {
+    std::vector<std::pair<uint32_t, uint32_t>> edges_;  // (u, v) with u < v
+    std::vector<double> costs_;
+    std::vector<uint32_t> offsets_;
+    std::vector<uint32_t> incident_;
+
+    [[nodiscard]] uint32_t get_other_end(uint32_t edge, uint32_t node) const {
+        const auto &[u, v] = edges_[edge];
+        return u == node ? v : u;
+    }
+};
+
+
+/*
+ * Computes the minimum spanning tree (a forest if the graph is not connected)
+ * of the graph w.r.t. the edge costs modified by the node penalties, i.e.
+ * c(u, v) + pi[u] + pi[v].
+ *
+ * This is Boruvka's algorithm -- in every round the lightest edge leaving
+ * each component is selected, so that the number of components is at least
+ * halved. The lightest edges incident to the nodes are found in parallel.
+ * The ties are broken by the edge index, hence the result does not depend
+ * on the number of threads.
+ */
+void compute_min_spanning_tree(const SparseGraph &graph,
+                               const std::vector<double> &pi,
+                               std::vector<uint32_t> &tree_edges) {
+    constexpr auto None = std::numeric_limits<uint32_t>::max();
+    const auto n = static_cast<uint32_t>(pi.size());
+    const auto m = static_cast<uint32_t>(graph.edges_.size());
+
+    std::vector<double> weights(m);
+    #pragma omp parallel for default(none) shared(graph, pi, weights, m)
+    for (uint32_t e = 0; e < m; ++e) {
+        const auto &[u, v] = graph.edges_[e];
+        weights[e] = graph.costs_[e] + pi[u] + pi[v];
+    }
+    auto is_lighter = [&weights](uint32_t a, uint32_t b) {
+        return a != None && (b == None || weights[a] < weights[b]
+                                       || (weights[a] == weights[b] && a < b));
+    };
+
+    std::vector<uint32_t> parent(n);  // Disjoint-set forest of the components
+    std::iota(parent.begin(), parent.end(), 0);
+    auto find = [&parent](uint32_t x) {
+        while (parent[x] != x) {
+            parent[x] = parent[parent[x]];
+            x = parent[x];
+        }
+        return x;
+    };
+
+    std::vector<uint32_t> component(n);
+    std::vector<uint32_t> node_lightest(n);
+    std::vector<uint32_t> component_lightest(n);
+    tree_edges.clear();
+
+    bool merged = true;
+    while (merged) {
+        for (uint32_t node = 0; node < n; ++node) {
+            component[node] = find(node);
+        }
+
+        #pragma omp parallel for default(none) schedule(dynamic, 1024) \
+                shared(graph, component, node_lightest, is_lighter, n)
+        for (uint32_t node = 0; node < n; ++node) {
+            auto lightest = None;
+            for (auto i = graph.offsets_[node]; i < graph.offsets_[node + 1]; ++i) {
+                const auto e = graph.incident_[i];
+                const auto other = graph.get_other_end(e, node);
+                if (component[other] != component[node] && is_lighter(e, lightest)) {
+                    lightest = e;
+                }
+            }
+            node_lightest[node] = lightest;
+        }
+
+        std::fill(component_lightest.begin(), component_lightest.end(), None);
+        for (uint32_t node = 0; node < n; ++node) {
+            auto &lightest = component_lightest[component[node]];
+            if (is_lighter(node_lightest[node], lightest)) {
+                lightest = node_lightest[node];
+            }
+        }
+
+        merged = false;
+        for (auto e : component_lightest) {
+            if (e == None) {
+                continue ;
+            }
+            const auto u = find(graph.edges_[e].first);
+            const auto v = find(graph.edges_[e].second);
+            if (u != v) {  // Two components may have selected the same edge
+                parent[u] = v;
+                tree_edges.push_back(e);
+                merged = true;
+            }
+        }
+    }
+}
+
+}  // namespace
+
+
+void ProblemInstance::order_nn_lists_by_alpha(uint32_t graph_degree, uint32_t ascent_iterations) {
+    using namespace std;
+
+    const auto n = dimension_;
+    const auto nn_per_node = total_nn_per_node_;
+    graph_degree = min(graph_degree, nn_per_node);
+    assert(all_nearest_neighbors_.size() == size_t{n} * nn_per_node);  // Not cached
+
+    SparseGraph graph;
+    auto &edges = graph.edges_;
+    edges.reserve(static_cast<size_t>(n) * graph_degree);
+    for (uint32_t node = 0; node < n; ++node) {
+        for (auto other : get_nearest_neighbors(node, graph_degree)) {
+            edges.emplace_back(min(node, other), max(node, other));
+        }
+    }
+    sort(edges.begin(), edges.end());
+    edges.erase(unique(edges.begin(), edges.end()), edges.end());
+    const auto m = static_cast<uint32_t>(edges.size());
+
+    graph.costs_.resize(m);
+    #pragma omp parallel for default(none) shared(graph, edges, m)
+    for (uint32_t e = 0; e < m; ++e) {
+        graph.costs_[e] = get_distance(edges[e].first, edges[e].second);
+    }
+
+    graph.offsets_.assign(n + 1, 0);
+    for (const auto &[u, v] : edges) {
+        ++graph.offsets_[u + 1];
+        ++graph.offsets_[v + 1];
+    }
+    partial_sum(graph.offsets_.begin(), graph.offsets_.end(), graph.offsets_.begin());
+    graph.incident_.resize(2 * m);
+    {
+        vector<uint32_t> next(graph.offsets_.begin(), graph.offsets_.end() - 1);
+        for (uint32_t e = 0; e < m; ++e) {
+            graph.incident_[next[edges[e].first]++] = e;
+            graph.incident_[next[edges[e].second]++] = e;
+        }
+    }
+
+    // Subgradient optimization of the penalties (Held & Karp). The bound
+    // w(pi) = L(T_pi) - 2 * sum(pi) is maximized, the step size follows the
+    // Polyak's rule with the length of the nearest neighbor tour as the upper
+    // bound
+    vector<double> pi(n, 0);
+    vector<double> best_pi(pi);
+    vector<uint32_t> tree_edges;
+    vector<int32_t> degree(n);
+    const auto upper_bound = calculate_route_length(build_nn_tour(0));
+    auto best_bound = -numeric_limits<double>::infinity();
+    double step_scale = 2;
+    uint32_t iterations_without_improvement = 0;
+
+    for (uint32_t iteration = 0; iteration < ascent_iterations; ++iteration) {
+        compute_min_spanning_tree(graph, pi, tree_edges);
+
+        fill(degree.begin(), degree.end(), 0);
+        double bound = 0;
+        for (auto e : tree_edges) {
+            const auto &[u, v] = edges[e];
+            bound += graph.costs_[e] + pi[u] + pi[v];
+            ++degree[u];
+            ++degree[v];
+        }
+        double norm = 0;
+        for (uint32_t node = 0; node < n; ++node) {
+            bound -= 2 * pi[node];
+            norm += (degree[node] - 2) * (degree[node] - 2);
+        }
+
+        if (bound > best_bound) {
+            best_bound = bound;
+            best_pi = pi;
+            iterations_without_improvement = 0;
+        } else if (++iterations_without_improvement == 5) {
+            step_scale /= 2;
+            iterations_without_improvement = 0;
+        }
+        if (norm == 0 || upper_bound <= bound) {
+            break ;
+        }
+        const auto step = step_scale * (upper_bound - bound) / norm;
+        for (uint32_t node = 0; node < n; ++node) {
+            pi[node] += step * (degree[node] - 2);
+        }
+    }
+
+    compute_min_spanning_tree(graph, best_pi, tree_edges);
+
+    // The tree neighbors of every node
+    vector<uint32_t> tree_offsets(n + 1, 0);
+    for (auto e : tree_edges) {
+        ++tree_offsets[edges[e].first + 1];
+        ++tree_offsets[edges[e].second + 1];
+    }
+    partial_sum(tree_offsets.begin(), tree_offsets.end(), tree_offsets.begin());
+    vector<uint32_t> tree_adjacent(2 * tree_edges.size());
+    vector<double> tree_costs(2 * tree_edges.size());
+    {
+        vector<uint32_t> next(tree_offsets.begin(), tree_offsets.end() - 1);
+        for (auto e : tree_edges) {
+            const auto &[u, v] = edges[e];
+            const auto cost = graph.costs_[e] + best_pi[u] + best_pi[v];
+            tree_costs[next[u]] = cost;
+            tree_adjacent[next[u]++] = v;
+            tree_costs[next[v]] = cost;
+            tree_adjacent[next[v]++] = u;
+        }
+    }
+
+    // Binary lifting -- ancestors[k * n + node] is the 2^k-th ancestor of the
+    // node and longest[k * n + node] is the max. cost of an edge on the path
+    // going to it
+    constexpr auto None = numeric_limits<uint32_t>::max();
+    vector<uint32_t> root(n, None);
+    vector<uint32_t> depth(n, 0);
+    uint32_t levels = 1;
+    while ((1u << levels) < n) {
+        ++levels;
+    }
+    vector<uint32_t> ancestors(static_cast<size_t>(levels) * n);
+    vector<double> longest(static_cast<size_t>(levels) * n, 0);
+    vector<uint32_t> queue;
+    queue.reserve(n);
+    for (uint32_t start = 0; start < n; ++start) {
+        if (root[start] != None) {
+            continue ;
+        }
+        root[start] = start;
+        ancestors[start] = start;
+        queue.clear();
+        queue.push_back(start);
+        for (size_t i = 0; i < queue.size(); ++i) {
+            const auto node = queue[i];
+            for (auto j = tree_offsets[node]; j < tree_offsets[node + 1]; ++j) {
+                const auto child = tree_adjacent[j];
+                if (root[child] == None) {
+                    root[child] = start;
+                    depth[child] = depth[node] + 1;
+                    ancestors[child] = node;
+                    longest[child] = tree_costs[j];
+                    queue.push_back(child);
+                }
+            }
+        }
+    }
+    for (uint32_t k = 1; k < levels; ++k) {
+        const auto prev = static_cast<size_t>(k - 1) * n;
+        const auto curr = static_cast<size_t>(k) * n;
+        #pragma omp parallel for default(none) shared(ancestors, longest, n, prev, curr)
+        for (uint32_t node = 0; node < n; ++node) {
+            const auto mid = ancestors[prev + node];
+            ancestors[curr + node] = ancestors[prev + mid];
+            longest[curr + node] = max(longest[prev + node], longest[prev + mid]);
+        }
+    }
+    auto get_longest_on_path = [&](uint32_t u, uint32_t v) {
+        double result = 0;
+        if (depth[u] < depth[v]) {
+            swap(u, v);
+        }
+        for (uint32_t k = 0, diff = depth[u] - depth[v]; diff > 0; ++k, diff >>= 1) {
+            if (diff & 1) {
+                result = max(result, longest[static_cast<size_t>(k) * n + u]);
+                u = ancestors[static_cast<size_t>(k) * n + u];
+            }
+        }
+        for (auto k = levels; u != v && k-- > 0; ) {
+            const auto level = static_cast<size_t>(k) * n;
+            if (ancestors[level + u] != ancestors[level + v]) {
+                result = max({ result, longest[level + u], longest[level + v] });
+                u = ancestors[level + u];
+                v = ancestors[level + v];
+            }
+        }
+        if (u != v) {
+            result = max({ result, longest[u], longest[v] });
+        }
+        return result;
+    };
+
+    #pragma omp parallel default(none) \
+            shared(n, nn_per_node, best_pi, root, tree_offsets, tree_adjacent, get_longest_on_path)
+    {
+        // (alpha, cost, node) for the current list and the tree neighbors
+        vector<tuple<double, double, uint32_t>> candidates;
+
+        #pragma omp for schedule(dynamic, 256)
+        for (uint32_t node = 0; node < n; ++node) {
+            auto alpha_of = [&](uint32_t other) {
+                const auto cost = get_distance(node, other) + best_pi[node] + best_pi[other];
+                // The nodes from different trees are not connected by a path
+                const auto alpha = root[node] == root[other]
+                                 ? cost - get_longest_on_path(node, other)
+                                 : cost;
+                return make_tuple(alpha, cost, other);
+            };
+
+            candidates.clear();
+            for (auto other : get_nearest_neighbors(node, nn_per_node)) {
+                candidates.push_back(alpha_of(other));
+            }
+            for (auto j = tree_offsets[node]; j < tree_offsets[node + 1]; ++j) {
+                const auto other = tree_adjacent[j];
+                if (none_of(candidates.begin(), candidates.end(),
+                            [other](const auto &c) { return get<2>(c) == other; })) {
+                    candidates.push_back(alpha_of(other));
+                }
+            }
+            sort(candidates.begin(), candidates.end());
+
+            auto it = all_nearest_neighbors_.begin() + node * nn_per_node;
+            for (uint32_t i = 0; i < nn_per_node; ++i) {
+                *it++ = get<2>(candidates[i]);
+            }
+        }
+    }
+    compute_nn_distances();
+}
+
+
 void route_to_svg(const ProblemInstance &instance,
                   const std::vector<uint32_t> &route,
                   const std::string &path) {
@@ -12,11 +12,15 @@
 #include <cassert>
 #include <cmath>
 #include <string>
+#include <type_traits>
 
 #include "kd_tree.h"
 #include "utils.h"
 
 
+class MappedFile;
+
+
 // Various types of edge weights used in TSPLIB
 enum EdgeWeightType { EUC_2D, EXPLICIT, GEO, ATT, CEIL_2D };
 
@@ -72,6 +76,184 @@ inline int32_t geo_distance (const Vec2d &p1, const Vec2d &p2) {
 }
 
 
+/*
+ * Distance functors, one per edge weight type. These return the same values
+ * as ProblemInstance::get_distance but the type is known at compile time,
+ * so that the distance computation can be inlined into the hot loops
+ * without any branching. See ProblemInstance::with_metric.
+ */
+template<int32_t (*DistanceFn)(const Vec2d &, const Vec2d &)>
+struct CoordsMetric {
+    const Vec2d *coords_;
+
+    double operator()(uint32_t from, uint32_t to) const {
+        return DistanceFn(coords_[from], coords_[to]);
+    }
+};
+
+using Euc2dMetric  = CoordsMetric<euc2d_distance>;
+using Ceil2dMetric = CoordsMetric<ceil_distance>;
+using AttMetric    = CoordsMetric<att_distance>;
+using GeoMetric    = CoordsMetric<geo_distance>;
+
+template<typename Value_t>
+struct MatrixMetric {
+    const Value_t *matrix_;
+    uint32_t dimension_;
+
+    double operator()(uint32_t from, uint32_t to) const {
+        return matrix_[size_t{from} * dimension_ + to];
+    }
+};
+
+
+/*
+ * Full (n x n) matrix of distances stored using the smallest type able to
+ * represent all of them exactly. TSPLIB distances are integers, so usually
+ * uint16_t or int32_t is enough, which takes 4 or 2 times less memory than
+ * double. Only one of the vectors is used, depending on the element type.
+ *
+ * The full layout is kept even for the symmetric instances as the upper
+ * triangle would need extra index arithmetic (and a branch) in every lookup.
+ */
+class DistanceMatrix {
+public:
+    enum ElementType { UINT16, INT32, DOUBLE };
+
+    // Returns the smallest type which can hold all of the integers from
+    // [min_value, max_value]
+    static ElementType get_element_type(double min_value, double max_value) {
+        if (min_value >= 0 && max_value <= std::numeric_limits<uint16_t>::max()) {
+            return UINT16;
+        }
+        if (min_value >= std::numeric_limits<int32_t>::min()
+                && max_value <= std::numeric_limits<int32_t>::max()) {
+            return INT32;
+        }
+        return DOUBLE;
+    }
+
+    static size_t get_element_size(ElementType type) {
+        return type == UINT16 ? sizeof(uint16_t)
+             : type == INT32  ? sizeof(int32_t)
+             : sizeof(double);
+    }
+
+    DistanceMatrix() = default;
+
+    // Stores the full matrix given in the row-major order
+    DistanceMatrix(uint32_t dimension, const std::vector<double> &values) {
+        assert(values.size() == size_t{dimension} * dimension);
+        bool all_integers = true;
+        for (auto value : values) {
+            all_integers &= (value == std::floor(value));
+        }
+        const auto [min_it, max_it] = std::minmax_element(values.begin(), values.end());
+        resize(dimension, all_integers ? get_element_type(*min_it, *max_it) : DOUBLE);
+        for (size_t i = 0; i < values.size(); ++i) {
+            set(i, values[i]);
+        }
+    }
+
+    void resize(uint32_t dimension, ElementType type) {
+        dimension_ = dimension;
+        type_ = type;
+        const size_t size = size_t{dimension} * dimension;
+        uint16_values_.assign(type == UINT16 ? size : 0, 0);
+        int32_values_.assign(type == INT32 ? size : 0, 0);
+        double_values_.assign(type == DOUBLE ? size : 0, 0);
+    }
+
+    [[nodiscard]] bool empty() const { return dimension_ == 0; }
+
+    [[nodiscard]] ElementType get_element_type() const { return type_; }
+
+    [[nodiscard]] double get(uint32_t from, uint32_t to) const {
+        const auto index = size_t{from} * dimension_ + to;
+        switch (type_) {
+            case UINT16: return uint16_values_[index];
+            case INT32:  return int32_values_[index];
+            default:     return double_values_[index];
+        }
+    }
+
+    void set(uint32_t from, uint32_t to, double value) {
+        set(size_t{from} * dimension_ + to, value);
+    }
+
+    /*
+     * Computes the whole matrix for the given symmetric distance function.
+     * The matrix is divided into square blocks and only the blocks on and
+     * above the diagonal are computed (in parallel), each value is also
+     * written to the transposed position. A pair of blocks fits in the
+     * cache, so the transposed (strided) writes are cheap.
+     */
+    template<typename DistanceFn>
+    void compute_symmetric(uint32_t dimension, ElementType type, const DistanceFn &distance) {
+        resize(dimension, type);
+        switch (type) {
+            case UINT16: fill_symmetric(uint16_values_.data(), distance); break ;
+            case INT32:  fill_symmetric(int32_values_.data(), distance); break ;
+            default:     fill_symmetric(double_values_.data(), distance);
+        }
+    }
+
+    template<typename Value_t>
+    [[nodiscard]] MatrixMetric<Value_t> get_metric() const {
+        if constexpr (std::is_same_v<Value_t, uint16_t>) {
+            return { uint16_values_.data(), dimension_ };
+        } else if constexpr (std::is_same_v<Value_t, int32_t>) {
+            return { int32_values_.data(), dimension_ };
+        } else {
+            return { double_values_.data(), dimension_ };
+        }
+    }
+
+private:
+    uint32_t dimension_ = 0;
+    ElementType type_ = DOUBLE;
+    std::vector<uint16_t> uint16_values_;
+    std::vector<int32_t> int32_values_;
+    std::vector<double> double_values_;
+
+    template<typename Value_t, typename DistanceFn>
+    void fill_symmetric(Value_t *values, const DistanceFn &distance) {
+        const uint32_t BlockSize = 64;
+        const auto n = dimension_;
+        const auto blocks = (n + BlockSize - 1) / BlockSize;
+
+        #pragma omp parallel for default(none) schedule(dynamic, 1) \
+                shared(values, distance, n, blocks, BlockSize)
+        for (uint32_t block_row = 0; block_row < blocks; ++block_row) {
+            const auto i_begin = block_row * BlockSize;
+            const auto i_end = std::min(n, i_begin + BlockSize);
+
+            for (auto block_col = block_row; block_col < blocks; ++block_col) {
+                const auto j_begin = block_col * BlockSize;
+                const auto j_end = std::min(n, j_begin + BlockSize);
+
+                for (auto i = i_begin; i < i_end; ++i) {
+                    auto *row = values + size_t{i} * n;
+                    for (auto j = std::max(j_begin, i); j < j_end; ++j) {
+                        const auto value = static_cast<Value_t>(distance(i, j));
+                        row[j] = value;
+                        values[size_t{j} * n + i] = value;
+                    }
+                }
+            }
+        }
+    }
+
+    void set(size_t index, double value) {
+        switch (type_) {
+            case UINT16: uint16_values_[index] = static_cast<uint16_t>(value); break ;
+            case INT32:  int32_values_[index] = static_cast<int32_t>(value); break ;
+            default:     double_values_[index] = value;
+        }
+    }
+};
+
+
 /*
  * This is used to implement nearest neighbor lists.
  *
@@ -100,6 +282,8 @@ public:
 
     [[nodiscard]] uint32_t size() const { return length_; }
 
+    [[nodiscard]] const uint32_t *data() const { return nodes_; }
+
     [[nodiscard]] iterator begin() const { return iterator(nodes_); }
 
     [[nodiscard]] iterator end() const { return iterator(nodes_ + length_); }
@@ -117,15 +301,29 @@ struct ProblemInstance {
     uint32_t dimension_;
     EdgeWeightType edge_weight_type_ = EUC_2D;
     std::vector<Point> coords_;  // Locations of the instance cities
-    std::vector<double> distance_matrix_;
+    DistanceMatrix distance_matrix_;
     // This stores a specified number of nearest neighbors for every node
     std::vector<uint32_t> all_nearest_neighbors_;
+    // Distances to the nearest neighbors (in the same layout), so that
+    // these need not be recomputed if there is no distance matrix
+    std::vector<double> all_nn_distances_;
     uint32_t total_nn_per_node_ = 0;
+    // The lists and the distances are read through these pointers, so that
+    // they can also refer to a memory-mapped cache file (see
+    // instance_cache.h), which is then kept open by cache_file_
+    const uint32_t *nn_lists_data_ = nullptr;
+    const double *nn_distances_data_ = nullptr;
+    std::shared_ptr<const MappedFile> cache_file_;
+    // Separate lists of the neighbors (and the distances) used by the LS if
+    // the lists above are not ordered by the distance, see compute_ls_lists
+    std::vector<uint32_t> ls_nearest_neighbors_;
+    std::vector<double> ls_nn_distances_;
+    uint32_t ls_nn_per_node_ = 0;
     bool is_symmetric_ = true;
     std::string name_;  // Optional name of the instance
     double best_known_cost_ = -1;
     // k-d tree instance for efficient computation of the nearest neighbors
-    mutable std::unique_ptr<KDTree> kdtree_ = nullptr;
+    std::unique_ptr<const KDTree> kdtree_ = nullptr;
 
 
     ProblemInstance(uint32_t dimension,
@@ -137,7 +335,6 @@ struct ProblemInstance {
                     double best_known_cost = -1)
         : dimension_(dimension),
           coords_(std::move(coords)),
-          distance_matrix_(distance_matrix),
           is_symmetric_(is_symmetric),
           name_(std::move(name)),
           best_known_cost_(best_known_cost) {
@@ -150,68 +347,269 @@ struct ProblemInstance {
             // We can use kd-tree to speed up nearest neighbor calculations
             kdtree_ = std::make_unique<KDTree>(coords_);
         }
-        // For smaller instances we can pre-calculate distances for faster
-        // computations
-        if (distance_matrix.empty() && dimension_ < 2000) {
-            std::vector<double> mat(dimension_ * dimension_);
-            for (uint32_t i = 0; i < dimension_; ++i) {
-                for (uint32_t j = 0; j < dimension_; ++j) {
-                    mat[i * dimension_ + j] = get_distance(i, j);
-                }
-            }
-            distance_matrix_ = mat;
+        if (!distance_matrix.empty()) {
+            distance_matrix_ = DistanceMatrix(dimension_, distance_matrix);
+        }
+    }
+
+    /*
+     * Returns an upper bound on the distance between any two nodes, based on
+     * the bounding box of the coordinates.
+     */
+    [[nodiscard]] double get_max_distance_bound() const {
+        if (edge_weight_type_ == GEO) {
+            return 20040;  // Half of the Earth's circumference (in km)
+        }
+        auto x_min = std::numeric_limits<double>::max(), x_max = std::numeric_limits<double>::lowest();
+        auto y_min = x_min, y_max = x_max;
+        for (const auto &p : coords_) {
+            x_min = std::min(x_min, p.x_);
+            x_max = std::max(x_max, p.x_);
+            y_min = std::min(y_min, p.y_);
+            y_max = std::max(y_max, p.y_);
         }
+        const auto diagonal = (Vec2d{ x_max, y_max } - Vec2d{ x_min, y_min }).length();
+        return std::ceil(edge_weight_type_ == ATT ? diagonal / std::sqrt(10.0) : diagonal) + 1;
     }
 
-    void compute_nn_lists(uint32_t nn_count) {
+    /*
+     * The lists are computed in parallel (for different nodes).
+     *
+     * If quadrant_count > 0, the first quadrant_count neighbors of each node
+     * are its quadrant neighbors, i.e. up to quadrant_count / 4 nearest nodes
+     * from each of the four quadrants around it. Missing ones (if a quadrant
+     * is sparse) are taken from the nearest nodes. The remaining positions
+     * hold the nearest nodes not already included. On clustered instances
+     * this adds the edges going between the clusters, which are missing from
+     * the pure nearest-neighbor lists. Quadrants require the kd-tree, so for
+     * the other instances the nearest neighbors are always used.
+     */
+    void compute_nn_lists(uint32_t nn_count, uint32_t quadrant_count = 0) {
         total_nn_per_node_ = std::min(nn_count, dimension_ - 1);
-        all_nearest_neighbors_.reserve(dimension_ * total_nn_per_node_);
+        all_nearest_neighbors_.assign(dimension_ * total_nn_per_node_, 0);
+        const auto nn_per_node = total_nn_per_node_;
+        quadrant_count = std::min(quadrant_count, nn_per_node);
 
         if (kdtree_ != nullptr) {
-            auto &kdtree = *kdtree_;
-            uint32_t n = kdtree.get_points_count();
-
-            for (uint32_t node = 0; node < n; ++node) {
-                for (uint32_t j = 0; j < total_nn_per_node_; ++j) {
-                    auto pt_idx = kdtree.nn_bottom_up(node);
-                    all_nearest_neighbors_.push_back(pt_idx);
-                    kdtree.delete_point(pt_idx);
-                }
-
-                // Revert changes so that kdtree can be reused for other
-                // lists
-                for (auto pt_idx : get_nearest_neighbors(node, total_nn_per_node_)) {
-                    kdtree.undelete_point(pt_idx);
+            const KDTree &kdtree = *kdtree_;
+            auto distance = [this](uint32_t a, uint32_t b) { return get_distance(a, b); };
+
+            #pragma omp parallel default(none) shared(kdtree, distance, nn_per_node, quadrant_count)
+            {
+                std::vector<std::pair<double, uint32_t>> nearest;
+                std::vector<std::pair<double, uint32_t>> in_quadrant;
+                std::vector<std::pair<double, uint32_t>> candidates;
+                nearest.reserve(nn_per_node);
+
+                #pragma omp for schedule(dynamic, 256)
+                for (uint32_t node = 0; node < dimension_; ++node) {
+                    kdtree.knn(node, nn_per_node, distance, nearest);
+                    auto it = all_nearest_neighbors_.begin() + node * nn_per_node;
+
+                    if (quadrant_count > 0) {
+                        collect_quadrant_neighbors(kdtree, node, quadrant_count, distance,
+                                                   nearest, in_quadrant, candidates);
+                        for (auto &[dist, pt_idx] : candidates) {
+                            *it++ = pt_idx;
+                        }
+                    }
+                    for (auto &[dist, pt_idx] : nearest) {
+                        if (it == all_nearest_neighbors_.begin() + (node + 1) * nn_per_node) {
+                            break ;
+                        }
+                        if (std::find(candidates.begin(), candidates.end(),
+                                      std::make_pair(dist, pt_idx)) == candidates.end()) {
+                            *it++ = pt_idx;
+                        }
+                    }
                 }
             }
         } else {
-            for (uint32_t node = 0; node < dimension_; ++node) {
+            #pragma omp parallel default(none) shared(nn_per_node)
+            {
                 std::vector<uint32_t> neighbors;
                 neighbors.reserve(dimension_);
-                for (uint32_t i = 0; i < dimension_; ++i) {
-                    if (i != node) {
-                        neighbors.push_back(i);
+
+                #pragma omp for schedule(dynamic, 16)
+                for (uint32_t node = 0; node < dimension_; ++node) {
+                    neighbors.clear();
+                    for (uint32_t i = 0; i < dimension_; ++i) {
+                        if (i != node) {
+                            neighbors.push_back(i);
+                        }
                     }
+                    // This puts the closest cand_list_size + 1 nodes in front
+                    // of the array (and sorted), the ties are broken by the
+                    // index as in KDTree::knn
+                    partial_sort(neighbors.begin(),
+                                neighbors.begin() + nn_per_node,
+                                neighbors.end(),
+                                [this, node](uint32_t a, uint32_t b) {
+                                    const auto da = this->get_distance(node, a);
+                                    const auto db = this->get_distance(node, b);
+                                    return da < db || (da == db && a < b);
+                                });
+
+                    std::copy(neighbors.begin(), neighbors.begin() + nn_per_node,
+                              all_nearest_neighbors_.begin() + node * nn_per_node);
                 }
-                // This puts the closest cand_list_size + 1 nodes in front of
-                // the array (and sorted)
-                partial_sort(neighbors.begin(),
-                            neighbors.begin() + std::min(total_nn_per_node_, dimension_),
-                            neighbors.end(),
-                            [this, node](uint32_t a, uint32_t b) {
-                                return this->get_distance(node, a) < this->get_distance(node, b);
-                            });
-
-                for (uint32_t i = 0; i < total_nn_per_node_; ++i) {
-                    all_nearest_neighbors_.push_back(neighbors.at(i));
+            }
+        }
+        compute_nn_distances();
+    }
+
+    void compute_nn_distances() {
+        all_nn_distances_.resize(all_nearest_neighbors_.size());
+        const auto n = static_cast<uint32_t>(all_nearest_neighbors_.size());
+
+        #pragma omp parallel for default(none) shared(n)
+        for (uint32_t i = 0; i < n; ++i) {
+            all_nn_distances_[i] = get_distance(i / total_nn_per_node_,
+                                                all_nearest_neighbors_[i]);
+        }
+        nn_lists_data_ = all_nearest_neighbors_.data();
+        nn_distances_data_ = all_nn_distances_.data();
+    }
+
+    // Uses the lists and the distances stored in a (memory-mapped) cache
+    // file instead of computing them
+    void use_cached_lists(std::shared_ptr<const MappedFile> file,
+                          uint32_t nn_per_node,
+                          const uint32_t *lists,
+                          const double *distances) {
+        cache_file_ = std::move(file);
+        total_nn_per_node_ = nn_per_node;
+        nn_lists_data_ = lists;
+        nn_distances_data_ = distances;
+        all_nearest_neighbors_.clear();
+        all_nn_distances_.clear();
+    }
+
+    /*
+     * The LS heuristics stop going through the neighbors of a node once
+     * these get too far, i.e. they need the neighbors ordered by the
+     * distance. This is not the case for the quadrant neighbors and for the
+     * lists ordered by the alpha-nearness, so for these the LS gets separate
+     * lists with the first ls_count neighbors of every node sorted by the
+     * distance. Without these lists the LS uses the (first) nearest
+     * neighbors.
+     */
+    void compute_ls_lists(uint32_t ls_count) {
+        ls_nn_per_node_ = std::min(ls_count, total_nn_per_node_);
+        ls_nearest_neighbors_.resize(size_t{dimension_} * ls_nn_per_node_);
+        ls_nn_distances_.resize(ls_nearest_neighbors_.size());
+        const auto nn_per_node = ls_nn_per_node_;
+
+        #pragma omp parallel default(none) shared(nn_per_node)
+        {
+            std::vector<std::pair<double, uint32_t>> neighbors;
+
+            #pragma omp for schedule(static)
+            for (uint32_t node = 0; node < dimension_; ++node) {
+                const auto *nn_distances = get_nn_distances(node);
+                neighbors.clear();
+                for (auto other : get_nearest_neighbors(node, nn_per_node)) {
+                    neighbors.emplace_back(*nn_distances++, other);
                 }
+                std::sort(neighbors.begin(), neighbors.end());
+
+                const auto offset = size_t{node} * nn_per_node;
+                for (uint32_t i = 0; i < nn_per_node; ++i) {
+                    std::tie(ls_nn_distances_[offset + i],
+                             ls_nearest_neighbors_[offset + i]) = neighbors[i];
+                }
+            }
+        }
+    }
+
+    /*
+     * Stores quadrant_count quadrant neighbors of the node (see
+     * compute_nn_lists) in the result, sorted by the distance. The nearest
+     * are the node's nearest neighbors (at least quadrant_count of them).
+     */
+    template<typename DistanceFn>
+    static void collect_quadrant_neighbors(const KDTree &kdtree,
+                                           uint32_t node,
+                                           uint32_t quadrant_count,
+                                           DistanceFn &distance,
+                                           const std::vector<std::pair<double, uint32_t>> &nearest,
+                                           std::vector<std::pair<double, uint32_t>> &in_quadrant,
+                                           std::vector<std::pair<double, uint32_t>> &result) {
+        constexpr auto inf = std::numeric_limits<double>::infinity();
+        const auto &p = kdtree.points_[node];
+        const KDTree::Bounds quadrants[] = {
+            { p.x_, inf, p.y_, inf },
+            { -inf, p.x_, p.y_, inf },
+            { -inf, p.x_, -inf, p.y_ },
+            { p.x_, inf, -inf, p.y_ },
+        };
+        const auto per_quadrant = std::max(1u, quadrant_count / 4);
+
+        result.clear();
+        for (const auto &region : quadrants) {
+            kdtree.knn_in_region(node, per_quadrant, distance, region, in_quadrant);
+            result.insert(result.end(), in_quadrant.begin(), in_quadrant.end());
+        }
+        // The nodes lying on the borders can belong to two quadrants
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+        if (result.size() > quadrant_count) {
+            result.resize(quadrant_count);
+        }
+
+        for (auto it = nearest.begin(); result.size() < quadrant_count && it != nearest.end(); ++it) {
+            if (std::find(result.begin(), result.end(), *it) == result.end()) {
+                result.push_back(*it);
             }
         }
+        std::sort(result.begin(), result.end());
     }
 
+    /*
+     * Reorders the lists computed by compute_nn_lists by the alpha-nearness
+     * of the neighbors, as in the LKH heuristic:
+     *
+     * Helsgaun, Keld. "An effective implementation of the Lin-Kernighan
+     * traveling salesman heuristic." European Journal of Operational
+     * Research 126.1 (2000): 106-130.
+     *
+     * The minimum spanning trees are computed for a sparse graph made of the
+     * first graph_degree neighbors of every node. The node penalties (pi
+     * values) are optimized by the subgradient method for a given number of
+     * iterations, and the tree neighbors are added to the lists. The special
+     * node of the 1-tree is not used, i.e. the alpha value of the edge (u, v)
+     * is its cost (with the penalties) minus the cost of the longest edge on
+     * the tree path between u and v.
+     */
+    void order_nn_lists_by_alpha(uint32_t graph_degree, uint32_t ascent_iterations);
+
     NodeList get_nearest_neighbors(uint32_t node, uint32_t nn_length) const {
         assert(nn_length <= total_nn_per_node_);
-        return NodeList{ &all_nearest_neighbors_[node * total_nn_per_node_], nn_length };
+        return NodeList{ nn_lists_data_ + node * total_nn_per_node_, nn_length };
+    }
+
+    // Returns the distances from the node to its nearest neighbors, in the
+    // order of get_nearest_neighbors
+    [[nodiscard]] const double *get_nn_distances(uint32_t node) const {
+        assert(nn_distances_data_ != nullptr);
+        return nn_distances_data_ + node * total_nn_per_node_;
+    }
+
+    // Returns the neighbors used by the LS, ordered by the distance
+    NodeList get_ls_neighbors(uint32_t node, uint32_t nn_length) const {
+        if (ls_nn_per_node_ == 0) {
+            return get_nearest_neighbors(node, nn_length);
+        }
+        assert(nn_length <= ls_nn_per_node_);
+        return NodeList{ ls_nearest_neighbors_.data() + node * ls_nn_per_node_, nn_length };
+    }
+
+    // Returns the distances in the order of get_ls_neighbors
+    [[nodiscard]] const double *get_ls_nn_distances(uint32_t node) const {
+        if (ls_nn_per_node_ == 0) {
+            return get_nn_distances(node);
+        }
+        return ls_nn_distances_.data() + node * ls_nn_per_node_;
     }
 
     std::vector<NodeList> get_nn_lists(uint32_t nn_length) const {
@@ -227,14 +625,14 @@ struct ProblemInstance {
     // Backup neighbors follow the nearest neighbors
     NodeList get_backup_neighbors(uint32_t node, uint32_t nn_size, uint32_t backup_nn_size) const {
         assert(nn_size + backup_nn_size <= total_nn_per_node_);
-        return NodeList{ &all_nearest_neighbors_[node * total_nn_per_node_] + nn_size, backup_nn_size };
+        return NodeList{ nn_lists_data_ + node * total_nn_per_node_ + nn_size, backup_nn_size };
     }
 
     double get_distance(uint32_t from, uint32_t to) const {
         assert((from < dimension_) && (to < dimension_));
 
         if (!distance_matrix_.empty()) {
-            return distance_matrix_[from * dimension_ + to];
+            return distance_matrix_.get(from, to);
         }
 
         auto a = coords_[from];
@@ -256,16 +654,71 @@ struct ProblemInstance {
         return 0;
     }
 
+    /*
+     * Calls fn with the distance functor matching the instance, e.g.
+     * Euc2dMetric for EUC_2D, or MatrixMetric if the distances were
+     * precomputed, and returns its result. This allows to select the metric
+     * once, instead of at every get_distance call.
+     */
+    template<typename Fn>
+    auto with_metric(Fn &&fn) const {
+        if (!distance_matrix_.empty()) {
+            switch (distance_matrix_.get_element_type()) {
+                case DistanceMatrix::UINT16:
+                    return fn(distance_matrix_.get_metric<uint16_t>());
+                case DistanceMatrix::INT32:
+                    return fn(distance_matrix_.get_metric<int32_t>());
+                default:
+                    return fn(distance_matrix_.get_metric<double>());
+            }
+        }
+        switch (edge_weight_type_) {
+            case CEIL_2D:
+                return fn(Ceil2dMetric{ coords_.data() });
+            case GEO:
+                return fn(GeoMetric{ coords_.data() });
+            case ATT:
+                return fn(AttMetric{ coords_.data() });
+            default:
+                assert(edge_weight_type_ == EUC_2D);
+                return fn(Euc2dMetric{ coords_.data() });
+        }
+    }
+
     double calculate_route_length(const std::vector<uint32_t> &route) const {
-        double distance = 0;
-        if (!route.empty()) {
-            auto prev_node = route.back();
-            for (auto node : route) {
-                distance += get_distance(prev_node, node);
-                prev_node = node;
+        return with_metric([&route](const auto &distance) {
+            double length = 0;
+            if (!route.empty()) {
+                auto prev_node = route.back();
+                for (auto node : route) {
+                    length += distance(prev_node, node);
+                    prev_node = node;
+                }
             }
+            return length;
+        });
+    }
+
+    /*
+     * For smaller instances we can pre-calculate distances for faster
+     * computations. The matrix is computed (in parallel) only if it was not
+     * given in the instance file and if it takes at most max_bytes of
+     * memory. The smallest suitable element type is used, so e.g. for 2000
+     * nodes the matrix of uint16_t takes about 8 MB.
+     */
+    void compute_distance_matrix(size_t max_bytes) {
+        if (!distance_matrix_.empty() || edge_weight_type_ == EXPLICIT) {
+            return ;
         }
-        return distance;
+        const auto type = DistanceMatrix::get_element_type(0, get_max_distance_bound());
+        if (size_t{dimension_} * dimension_ * DistanceMatrix::get_element_size(type) > max_bytes) {
+            return ;
+        }
+        DistanceMatrix matrix;
+        with_metric([&](const auto &distance) {
+            matrix.compute_symmetric(dimension_, type, distance);
+        });
+        distance_matrix_ = std::move(matrix);
     }
 
     bool is_route_valid(const std::vector<uint32_t> &route) const {
@@ -288,32 +741,35 @@ struct ProblemInstance {
         tour.push_back(start_node);
 
         if (kdtree_ != nullptr) {
-            auto &kdtree = *kdtree_;
+            // The view does not modify the kd-tree, so that many tours can
+            // be built in parallel
+            KDTreeView kdtree(*kdtree_);
             kdtree.delete_point(start_node);
 
+            auto distance = [this](uint32_t a, uint32_t b) { return get_distance(a, b); };
             for (uint32_t i = 1; i < dimension_; ++i) {
-                auto pt_idx = kdtree.nn(tour.back());
+                auto pt_idx = kdtree.nn(tour.back(), distance);
                 tour.push_back(pt_idx);
                 kdtree.delete_point(pt_idx);
             }
-
-            for (auto it = tour.rbegin(); it != tour.rend(); ++it) {
-                kdtree.undelete_point(*it);
-            }
         } else {  // Use NN lists
             Bitmask visited(dimension_);
             visited.set_bit(start_node);
             for (uint32_t i = 1; i < dimension_; ++i) {
                 auto prev = tour.back();
                 auto next = prev;
+                // The lists need not be ordered by the distance (see
+                // order_nn_lists_by_alpha), so the nearest unvisited is taken
+                const auto *nn_distances = get_nn_distances(prev);
+                double min_cost = std::numeric_limits<double>::max();
                 for (auto node : get_nearest_neighbors(prev, total_nn_per_node_)) {
-                    if (!visited[node]) {
+                    const auto cost = *nn_distances++;
+                    if (!visited[node] && cost < min_cost) {
+                        min_cost = cost;
                         next = node;
-                        break ;
                     }
                 }
                 if (next == prev) {
-                    double min_cost = std::numeric_limits<double>::max();
                     for (uint32_t node = 0; node < dimension_; ++node) {
                         if (!visited[node] && get_distance(prev, node) < min_cost) {
                             min_cost = get_distance(prev, node);
@@ -343,14 +799,15 @@ struct ProblemInstance {
 /**
  * Tries to load a Traveling Salesman Problem (or ATSP) instance in TSPLIB
  * format from file at 'path'. Only the instances with 'EDGE_WEIGHT_TYPE:
- * EUC_2D' or 'EXPLICIT' are supported.
+ * EUC_2D' or 'EXPLICIT' are supported. If verbose is true, the header of
+ * the file is written to the standard output.
  *
  * Throws runtime_error if the file is in unsupported format or if an error was
  * encountered.
  *
  * Returns the loaded problem instance.
  */
-ProblemInstance load_tsplib_instance(const char *path);
+ProblemInstance load_tsplib_instance(const char *path, bool verbose = true);
 
 
 void route_to_svg(const ProblemInstance &instance,
@@ -69,6 +69,10 @@ ProgramOptions parse_program_options(int argc, char *argv[]) {
 
     p.add("cand-list-size", "Size of the candidate list", opts.cand_list_size_);
 
+    p.add("cand-list-type", "How the candidate lists are built [nn,quadrant,alpha]", opts.cand_list_type_);
+
+    p.add("precision", "Storage of the pheromone and the products [double,float,q16]", opts.precision_);
+
     p.add("id", "Id of the experiment (optional)", opts.id_);
 
     p.add("gbest-as-source-prob",
@@ -77,8 +81,17 @@ ProgramOptions parse_program_options(int argc, char *argv[]) {
 
     p.add("i,iterations", "Iterations count", opts.iterations_);
 
+    p.add("time-limit", "Time limit (sec.) of a single execution (0 - no limit)", opts.time_limit_);
+
+    p.add("target-cost", "Stop when a solution of at most this cost is found (0 - disabled)", opts.target_cost_);
+
+    p.add("target-error", "Stop when the relative error (%) is at most this (< 0 - disabled)", opts.target_error_);
+
     p.add("local-search", "Should local search be used", opts.local_search_);
 
+    p.add("ls", "Local search type [2opt,3opt,oropt,lk]", opts.local_search_type_);
+    p.add("tour", "Tour representation used by the local search [array,2level,tree]", opts.tour_type_);
+
     p.add("ls-cand-list-size", "# of nearest nodes considered by the local search", opts.ls_cand_list_size_);
 
     p.add("min-new-edges", "Min # of new edges in a constructed sol.", opts.min_new_edges_);
@@ -89,13 +102,23 @@ ProgramOptions parse_program_options(int argc, char *argv[]) {
 
     p.add("p-best", "p_best parameter of the MMAS", opts.p_best_);
 
+    p.add("q0", "Prob. of selecting the best candidate greedily (ACS rule)", opts.q0_);
+
+    p.add("row-sampling", "Sample the candidates using precomputed cumulative sums?", opts.row_sampling_);
+
     p.add("picture", "Generate route picture in SVG format?", opts.save_route_picture_);
 
+    p.add("print-header", "Print the header of the instance file when loading it?", opts.print_header_);
+
     p.add("p,problem", "Path to a TSP instance in the TSPLIB format",
                opts.problem_path_);
 
     p.add("results-dir", "Where to store the results", opts.results_dir_);
 
+    p.add("cache-dir", "Where to cache the preprocessed instances (empty to disable)", opts.cache_dir_);
+
+    p.add("max-matrix-mb", "Max. memory (MiB) of the precomputed distance matrix", opts.max_matrix_mb_);
+
     p.add("rho", "How much of the pheromone remains after evaporation", opts.rho_);
 
     p.add("seed", "Initial Random seed", opts.seed_);
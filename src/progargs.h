@@ -22,6 +22,16 @@ struct ProgramOptions {
 
     uint32_t cand_list_size_ = 16;
 
+    // How the candidate lists are built: nn (nearest neighbors), quadrant
+    // (nearest neighbors from each of the four quadrants around a node) or
+    // alpha (ordered by the alpha-nearness, as in LKH)
+    std::string cand_list_type_ = "nn";
+
+    // How the pheromone trails and the products of the trails and the
+    // heuristic are stored: double, float or q16 (float trails and 16-bit
+    // quantized products)
+    std::string precision_ = "double";
+
     std::string id_ = "default";  // Id of the comp. experiment
 
     // Probability of using the current global best as a source solution
@@ -29,7 +39,24 @@ struct ProgramOptions {
 
     int32_t iterations_ = 5 * 1000;
 
-    int32_t local_search_ = 1;  // 0 - no local search, 1 - default LS
+    // The computations stop before the iterations count is reached if the
+    // time limit (in seconds) is exceeded or if a solution of at most the
+    // target cost (or the target relative error in %, w.r.t. the best known
+    // solution) is found. Values <= 0 (< 0 for the error) disable them.
+    double time_limit_ = 0;
+    double target_cost_ = 0;
+    double target_error_ = -1;
+
+    int32_t local_search_ = 1;  // 0 - no local search, 1 - LS selected with --ls
+
+    // Type of the local search: 2opt, 3opt, oropt (2-opt followed by
+    // Or-opt) or lk (Lin-Kernighan style)
+    std::string local_search_type_ = "2opt";
+
+    // Tour representation used by the local search: array, 2level
+    // (two-level doubly-linked list, faster flips for large instances) or
+    // tree (balanced tree, O(log n) flips for the largest instances)
+    std::string tour_type_ = "array";
 
     uint32_t ls_cand_list_size_ = 20u;  // #nodes used by the LS heuristics
 
@@ -39,6 +66,15 @@ struct ProgramOptions {
     uint32_t min_changes = 4;
     uint32_t max_changes = 16;
 
+    // Prob. of selecting the candidate with the max. product of pheromone
+    // and heuristic instead of using the random proportional rule (as in
+    // the Ant Colony System). 0 means always random proportional.
+    double q0_ = 0;
+
+    // If true, the candidates are sampled using the cumulative sums of the
+    // products precomputed for every node, rejecting the visited ones
+    bool row_sampling_ = false;
+
     // Prob. that a solution will contain only edges with the
     // highest pheromone levels. Used to calculate pheromone trail limits.
     double p_best_ = 0.1;
@@ -51,9 +87,20 @@ struct ProgramOptions {
     // How much of the pheromone remains after a single evaporation event
     double rho_ = 0.5;
 
+    // Max. memory (in MiB) for a precomputed matrix of distances, larger
+    // instances compute the distances on demand
+    uint32_t max_matrix_mb_ = 32;
+
+    // If not empty, the preprocessed instance (with the candidate lists) is
+    // stored in this folder and loaded from it on the next runs
+    std::string cache_dir_ = "";
+
     // Should a picture of the solution (route) be stored into SVG file?
     bool save_route_picture_ = true;
 
+    // Should the header of the instance file be printed when it is loaded?
+    bool print_header_ = true;
+
     // Random number generator seed -- 0 means that seed should be 
     // based on the built-in std::random_device
     uint64_t seed_ = 0;
@@ -71,20 +118,32 @@ void dump(const ProgramOptions &opt, MapT &map) {
     map["backup list size"] = opt.backup_list_size_;
     map["beta"] = opt.beta_;
     map["cand list size"] = opt.cand_list_size_;
+    map["cand list type"] = opt.cand_list_type_;
+    map["precision"] = opt.precision_;
     map["id"] = opt.id_;
     map["gbest as source prob"] = opt.gbest_as_source_prob_;
     map["iterations"] = opt.iterations_;
+    map["time limit"] = opt.time_limit_;
+    map["target cost"] = opt.target_cost_;
+    map["target error"] = opt.target_error_;
     map["local search"] = opt.local_search_;
+    map["ls"] = opt.local_search_type_;
+    map["tour"] = opt.tour_type_;
     map["ls cand list size"] = opt.ls_cand_list_size_;
     map["min new edges"] = opt.min_new_edges_;
     map["min changes"] = opt.min_changes;
     map["max changes"] = opt.max_changes;
     map["p best"] = opt.p_best_;
+    map["q0"] = opt.q0_;
+    map["row sampling"] = opt.row_sampling_;
     map["problem"] = opt.problem_path_;
     map["results dir"] = opt.results_dir_;
+    map["cache dir"] = opt.cache_dir_;
+    map["max matrix mb"] = opt.max_matrix_mb_;
     map["rho"] = opt.rho_;
     map["seed"] = opt.seed_;
     map["picture"] = opt.save_route_picture_;
+    map["print header"] = opt.print_header_;
     map["repeat"] = opt.repeat_;
     map["threads"] = opt.threads_;
 }
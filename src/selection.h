@@ -0,0 +1,382 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <type_traits>
+
+#include "rand.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+
+/**
+ * Kernels used by the ants to select the next node from the candidate list of
+ * the current node. The candidate list has at most 32 nodes, so the unvisited
+ * ones are represented with a 32-bit mask, in which bit i corresponds to the
+ * i-th node on the list.
+ *
+ * If the AVX2 instructions are available (-mavx2) the vectorized versions are
+ * used, otherwise the scalar ones.
+ */
+
+// Type used to sum the products -- the quantized products are summed exactly
+// using integers
+template<typename Product_t>
+using product_sum_t = std::conditional_t<std::is_integral_v<Product_t>, uint32_t, Product_t>;
+
+// Returns a mask with bit i set if the nodes[i] is not visited, i.e. its bit
+// in visited_words is not set
+inline uint32_t get_unvisited_mask_scalar(const uint32_t *nodes, uint32_t count,
+                                          const uint32_t *visited_words) {
+    assert(count <= 32);
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        const auto node = nodes[i];
+        const auto visited = (visited_words[node / 32] >> (node % 32)) & 1u;
+        mask |= (visited ^ 1u) << i;
+    }
+    return mask;
+}
+
+/*
+ * Roulette wheel selection among the candidates in the mask, with the
+ * probabilities proportional to the products. u should be a random number
+ * from [0, 1). Returns the position of the selected candidate.
+ */
+template<typename Product_t>
+uint32_t select_by_roulette_scalar(const Product_t *products, uint32_t count,
+                                   uint32_t mask, double u) {
+    assert(mask != 0 && count <= 32);
+    using Sum_t = product_sum_t<Product_t>;
+    Sum_t prefix_sums[32];
+    Sum_t sum = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        const Sum_t valid = (mask >> i) & 1u;
+        sum += products[i] * valid;
+        prefix_sums[i] = sum;
+    }
+    // The prefix sums do not increase at the positions of the visited nodes
+    // so these cannot be selected
+    const auto r = u * sum;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (r < prefix_sums[i]) {
+            return i;
+        }
+    }
+    return 31 - __builtin_clz(mask);  // Can happen only due to rounding
+}
+
+// Returns the position of the (first) candidate in the mask with the max.
+// product
+template<typename Product_t>
+uint32_t select_max_product_scalar(const Product_t *products, uint32_t count,
+                                   uint32_t mask) {
+    assert(mask != 0 && count <= 32);
+    auto result = static_cast<uint32_t>(__builtin_ctz(mask));
+    auto max_product = products[result];
+    for (uint32_t i = result + 1; i < count; ++i) {
+        if (((mask >> i) & 1u) && max_product < products[i]) {
+            max_product = products[i];
+            result = i;
+        }
+    }
+    return result;
+}
+
+
+#ifdef __AVX2__
+
+inline uint32_t get_unvisited_mask_avx2(const uint32_t *nodes, uint32_t count,
+                                        const uint32_t *visited_words) {
+    assert(count <= 32);
+    const auto lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const auto one = _mm256_set1_epi32(1);
+    const auto base = reinterpret_cast<const int *>(visited_words);
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < count; i += 8) {
+        // Only the lanes with i + lane < count are loaded
+        const auto in_range = _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(count - i)), lanes);
+        const auto idx = _mm256_maskload_epi32(reinterpret_cast<const int *>(nodes + i), in_range);
+        const auto words = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), base,
+                                                       _mm256_srli_epi32(idx, 5), in_range, 4);
+        const auto bits = _mm256_and_si256(_mm256_srlv_epi32(words, _mm256_and_si256(idx, _mm256_set1_epi32(31))), one);
+        const auto unvisited = _mm256_andnot_si256(_mm256_cmpeq_epi32(bits, one), in_range);
+        mask |= static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(unvisited))) << i;
+    }
+    return mask;
+}
+
+// Inclusive prefix sum of the 4 values
+inline __m256d prefix_sum_pd(__m256d x) {
+    const auto zero = _mm256_setzero_pd();
+    x = _mm256_add_pd(x, _mm256_blend_pd(_mm256_permute4x64_pd(x, _MM_SHUFFLE(2, 1, 0, 0)), zero, 0b0001));
+    x = _mm256_add_pd(x, _mm256_blend_pd(_mm256_permute4x64_pd(x, _MM_SHUFFLE(1, 0, 0, 0)), zero, 0b0011));
+    return x;
+}
+
+// Inclusive prefix sum of the 8 values
+inline __m256 prefix_sum_ps(__m256 x) {
+    // Prefix sums inside 128-bit lanes, then the last value of the low lane
+    // is added to the high lane
+    x = _mm256_add_ps(x, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(x), 4)));
+    x = _mm256_add_ps(x, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(x), 8)));
+    const auto low_total = _mm256_permute_ps(x, _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm256_add_ps(x, _mm256_permute2f128_ps(low_total, low_total, 0x08));
+}
+
+// Inclusive prefix sum of the 8 values
+inline __m256i prefix_sum_epi32(__m256i x) {
+    x = _mm256_add_epi32(x, _mm256_slli_si256(x, 4));
+    x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+    const auto low_total = _mm256_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm256_add_epi32(x, _mm256_permute2x128_si256(low_total, low_total, 0x08));
+}
+
+// Expands the lowest 4 bits of the mask into 64-bit lanes
+inline __m256i expand_mask_epi64(uint32_t bits) {
+    const auto lane_bits = _mm256_setr_epi64x(1, 2, 4, 8);
+    return _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_set1_epi64x(bits), lane_bits), lane_bits);
+}
+
+// Expands the lowest 8 bits of the mask into 32-bit lanes
+inline __m256i expand_mask_epi32(uint32_t bits) {
+    const auto lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    return _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(static_cast<int>(bits)), lane_bits), lane_bits);
+}
+
+/*
+ * The vectorized versions of select_by_roulette_scalar. The products of the
+ * visited nodes are masked out when loading, so that the prefix sums can be
+ * computed in the vector registers, and the selected position is found by
+ * comparing the whole vectors with r.
+ */
+inline uint32_t select_by_roulette_avx2(const double *products, uint32_t count,
+                                        uint32_t mask, double u) {
+    assert(mask != 0 && count <= 32);
+    alignas(32) double prefix_sums[32];
+    auto carry = _mm256_setzero_pd();
+    for (uint32_t i = 0; i < count; i += 4) {
+        // The lanes past count are never in the mask, so are not loaded
+        const auto x = _mm256_maskload_pd(products + i, expand_mask_epi64(mask >> i));
+        const auto sums = _mm256_add_pd(prefix_sum_pd(x), carry);
+        _mm256_store_pd(prefix_sums + i, sums);
+        carry = _mm256_permute4x64_pd(sums, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    const auto r = _mm256_set1_pd(u * _mm256_cvtsd_f64(carry));
+    for (uint32_t i = 0; i < count; i += 4) {
+        const auto below = _mm256_movemask_pd(_mm256_cmp_pd(r, _mm256_load_pd(prefix_sums + i), _CMP_LT_OQ));
+        if (below != 0) {
+            return i + __builtin_ctz(static_cast<uint32_t>(below));
+        }
+    }
+    return 31 - __builtin_clz(mask);
+}
+
+inline uint32_t select_by_roulette_avx2(const float *products, uint32_t count,
+                                        uint32_t mask, double u) {
+    assert(mask != 0 && count <= 32);
+    alignas(32) float prefix_sums[32];
+    auto carry = _mm256_setzero_ps();
+    for (uint32_t i = 0; i < count; i += 8) {
+        const auto x = _mm256_maskload_ps(products + i, expand_mask_epi32(mask >> i));
+        const auto sums = _mm256_add_ps(prefix_sum_ps(x), carry);
+        _mm256_store_ps(prefix_sums + i, sums);
+        carry = _mm256_permutevar8x32_ps(sums, _mm256_set1_epi32(7));
+    }
+    const auto r = _mm256_set1_ps(static_cast<float>(u * _mm256_cvtss_f32(carry)));
+    for (uint32_t i = 0; i < count; i += 8) {
+        const auto below = _mm256_movemask_ps(_mm256_cmp_ps(r, _mm256_load_ps(prefix_sums + i), _CMP_LT_OQ));
+        if (below != 0) {
+            return i + __builtin_ctz(static_cast<uint32_t>(below));
+        }
+    }
+    return 31 - __builtin_clz(mask);
+}
+
+inline uint32_t select_by_roulette_avx2(const uint16_t *products, uint32_t count,
+                                        uint32_t mask, double u) {
+    assert(mask != 0 && count <= 32);
+    if (count % 8 != 0) {  // There is no masked load of 16-bit values
+        return select_by_roulette_scalar(products, count, mask, u);
+    }
+    alignas(32) uint32_t prefix_sums[32];
+    auto carry = _mm256_setzero_si256();
+    for (uint32_t i = 0; i < count; i += 8) {
+        const auto x = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(products + i)));
+        const auto sums = _mm256_add_epi32(prefix_sum_epi32(_mm256_and_si256(x, expand_mask_epi32(mask >> i))), carry);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(prefix_sums + i), sums);
+        carry = _mm256_permutevar8x32_epi32(sums, _mm256_set1_epi32(7));
+    }
+    // For an integer p, r < p iff floor(r) < p. The sums are below 2^31 so
+    // the signed comparison can be used
+    const auto sum = static_cast<uint32_t>(_mm256_cvtsi256_si32(carry));
+    const auto r = _mm256_set1_epi32(static_cast<int>(u * sum));
+    for (uint32_t i = 0; i < count; i += 8) {
+        const auto p = _mm256_load_si256(reinterpret_cast<const __m256i *>(prefix_sums + i));
+        const auto below = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(p, r)));
+        if (below != 0) {
+            return i + __builtin_ctz(static_cast<uint32_t>(below));
+        }
+    }
+    return 31 - __builtin_clz(mask);
+}
+
+/*
+ * The vectorized versions of select_max_product_scalar. The max. product is
+ * found first, then the position of the first candidate with that product.
+ * The products of the visited nodes are zeroed so they can be selected only
+ * if all the products are zero, hence the final check against the mask.
+ */
+inline uint32_t select_max_product_avx2(const double *products, uint32_t count,
+                                        uint32_t mask) {
+    assert(mask != 0 && count <= 32);
+    auto max_values = _mm256_setzero_pd();
+    for (uint32_t i = 0; i < count; i += 4) {
+        max_values = _mm256_max_pd(max_values, _mm256_maskload_pd(products + i, expand_mask_epi64(mask >> i)));
+    }
+    max_values = _mm256_max_pd(max_values, _mm256_permute4x64_pd(max_values, _MM_SHUFFLE(1, 0, 3, 2)));
+    max_values = _mm256_max_pd(max_values, _mm256_permute4x64_pd(max_values, _MM_SHUFFLE(2, 3, 0, 1)));
+    uint32_t found = 0;
+    for (uint32_t i = 0; i < count && (found & mask) == 0; i += 4) {
+        const auto x = _mm256_maskload_pd(products + i, expand_mask_epi64(mask >> i));
+        found |= static_cast<uint32_t>(_mm256_movemask_pd(_mm256_cmp_pd(x, max_values, _CMP_EQ_OQ))) << i;
+    }
+    return static_cast<uint32_t>(__builtin_ctz(found & mask));
+}
+
+inline uint32_t select_max_product_avx2(const float *products, uint32_t count,
+                                        uint32_t mask) {
+    assert(mask != 0 && count <= 32);
+    auto max_values = _mm256_setzero_ps();
+    for (uint32_t i = 0; i < count; i += 8) {
+        max_values = _mm256_max_ps(max_values, _mm256_maskload_ps(products + i, expand_mask_epi32(mask >> i)));
+    }
+    max_values = _mm256_max_ps(max_values, _mm256_permute2f128_ps(max_values, max_values, 0x01));
+    max_values = _mm256_max_ps(max_values, _mm256_permute_ps(max_values, _MM_SHUFFLE(1, 0, 3, 2)));
+    max_values = _mm256_max_ps(max_values, _mm256_permute_ps(max_values, _MM_SHUFFLE(2, 3, 0, 1)));
+    uint32_t found = 0;
+    for (uint32_t i = 0; i < count && (found & mask) == 0; i += 8) {
+        const auto x = _mm256_maskload_ps(products + i, expand_mask_epi32(mask >> i));
+        found |= static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(x, max_values, _CMP_EQ_OQ))) << i;
+    }
+    return static_cast<uint32_t>(__builtin_ctz(found & mask));
+}
+
+inline uint32_t select_max_product_avx2(const uint16_t *products, uint32_t count,
+                                        uint32_t mask) {
+    // The products are small enough for the scalar version to be as fast
+    return select_max_product_scalar(products, count, mask);
+}
+
+#endif
+
+
+inline uint32_t get_unvisited_mask(const uint32_t *nodes, uint32_t count,
+                                   const uint32_t *visited_words) {
+#ifdef __AVX2__
+    return get_unvisited_mask_avx2(nodes, count, visited_words);
+#else
+    return get_unvisited_mask_scalar(nodes, count, visited_words);
+#endif
+}
+
+template<typename Product_t>
+uint32_t select_by_roulette(const Product_t *products, uint32_t count,
+                            uint32_t mask, double u) {
+#ifdef __AVX2__
+    return select_by_roulette_avx2(products, count, mask, u);
+#else
+    return select_by_roulette_scalar(products, count, mask, u);
+#endif
+}
+
+template<typename Product_t>
+uint32_t select_max_product(const Product_t *products, uint32_t count,
+                            uint32_t mask) {
+#ifdef __AVX2__
+    return select_max_product_avx2(products, count, mask);
+#else
+    return select_max_product_scalar(products, count, mask);
+#endif
+}
+
+
+/**
+ * Selection rules (policies) deciding which of the unvisited candidates (in
+ * the mask) becomes the next node. Each provides
+ *
+ *     uint32_t select(uint32_t row, const Product_t *products, uint32_t count,
+ *                     uint32_t mask) const
+ *
+ * returning the position of the selected candidate, where products are the
+ * products of the pheromone and the heuristic for the candidates of the node
+ * (row).
+ */
+
+// The random proportional rule of the Ant System / MAX-MIN Ant System
+struct RouletteWheelSelection {
+    template<typename Product_t>
+    [[nodiscard]] uint32_t select(uint32_t /*row*/, const Product_t *products,
+                                  uint32_t count, uint32_t mask) const {
+        return select_by_roulette(products, count, mask, get_rng().next_float());
+    }
+};
+
+/*
+ * The random proportional rule using the cumulative sums of the products of
+ * every row, computed when the products are updated. A candidate is drawn
+ * from the whole row by a binary search, and rejected if it was visited,
+ * which gives the same distribution as the roulette wheel over the
+ * unvisited candidates. Early in the construction most of the candidates are
+ * unvisited, so usually the first draw is accepted. After MaxDraws rejected
+ * draws (or if cumulative_sums_ is null) the roulette wheel is used.
+ */
+template<typename Sum_t>
+struct PrecomputedRowSelection {
+    static constexpr uint32_t MaxDraws = 3;
+
+    const Sum_t *cumulative_sums_ = nullptr;
+
+    template<typename Product_t>
+    [[nodiscard]] uint32_t select(uint32_t row, const Product_t *products,
+                                  uint32_t count, uint32_t mask) const {
+        static_assert(std::is_same_v<Sum_t, product_sum_t<Product_t>>);
+        if (cumulative_sums_ != nullptr) {
+            const auto first = cumulative_sums_ + row * count;
+            const auto total = first[count - 1];
+            for (uint32_t i = 0; i < MaxDraws; ++i) {
+                const auto r = get_rng().next_float() * total;
+                const auto pos = static_cast<uint32_t>(std::upper_bound(first, first + count, r) - first);
+                if (pos < count && ((mask >> pos) & 1u)) {
+                    return pos;
+                }
+            }
+        }
+        return RouletteWheelSelection{}.select(row, products, count, mask);
+    }
+};
+
+/*
+ * The pseudo-random proportional rule of the Ant Colony System -- with
+ * prob. q0 the candidate with the max. product is selected, otherwise the
+ * random proportional rule (ProportionalRule_t) is used. No random number is
+ * drawn for q0 = 0, so the results are the same as for the proportional rule
+ * alone.
+ */
+template<typename ProportionalRule_t = RouletteWheelSelection>
+struct PseudoRandomProportionalSelection {
+    double q0_ = 0;
+    ProportionalRule_t proportional_rule_{};
+
+    template<typename Product_t>
+    [[nodiscard]] uint32_t select(uint32_t row, const Product_t *products,
+                                  uint32_t count, uint32_t mask) const {
+        if (q0_ > 0 && get_rng().next_float() < q0_) {
+            return select_max_product(products, count, mask);
+        }
+        return proportional_rule_.select(row, products, count, mask);
+    }
+};
@@ -0,0 +1,360 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+
+/**
+ * Tour stored as an implicit treap (randomized balanced binary search tree
+ * keyed by the position in the tour), in which each node corresponds to a
+ * single city. Every tree node has a lazy reversal flag so that a part of the
+ * tour can be reversed by splitting the tree, toggling the flag of the middle
+ * part and merging the parts back.
+ *
+ * The expected time of get_succ, get_pred, between, flip and relocate is
+ * O(log(n)) which makes this representation suitable for very large
+ * instances (100k+ nodes), for which O(sqrt(n)) of the two-level list is too
+ * slow.
+ *
+ * The queries do not modify the tree, the pending reversals are taken into
+ * account when traversing it.
+ */
+class TreeTour {
+public:
+    static constexpr uint32_t Nil = UINT32_MAX;
+
+    struct Node {
+        uint32_t left_ = Nil;
+        uint32_t right_ = Nil;
+        uint32_t parent_ = Nil;
+        uint32_t size_ = 1;      // Size of the subtree
+        uint32_t priority_ = 0;  // Random, the tree is a max-heap w.r.t. it
+        bool reversed_ = false;  // Should the subtree be mirrored?
+    };
+
+    std::vector<Node> nodes_;
+    uint32_t root_ = Nil;
+    std::vector<uint32_t> stack_;
+
+    TreeTour() = default;
+
+    explicit TreeTour(const std::vector<uint32_t> &route) {
+        init(route);
+    }
+
+    /*
+     * Builds the tree in O(n) time, similarly to a Cartesian tree -- the nodes
+     * are added in the order of the route, and the rightmost path of the tree
+     * is kept on a stack.
+     */
+    void init(const std::vector<uint32_t> &route) {
+        const auto n = static_cast<uint32_t>(route.size());
+        assert(n > 0);
+
+        if (nodes_.size() != n) {  // Priorities do not depend on the route
+            nodes_.resize(n);
+            uint64_t state = 0x9E3779B97F4A7C15ULL;
+            for (auto &node : nodes_) {  // splitmix64
+                state += 0x9E3779B97F4A7C15ULL;
+                auto z = state;
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+                node.priority_ = static_cast<uint32_t>(z ^ (z >> 31));
+            }
+        }
+
+        // The subtree of a node is complete when it is removed from the stack,
+        // so that its size can be computed
+        stack_.clear();
+        for (auto node : route) {
+            auto &n = nodes_[node];
+            n.right_ = Nil;
+            n.parent_ = Nil;
+            n.reversed_ = false;
+            uint32_t last = Nil;
+            while (!stack_.empty() && nodes_[stack_.back()].priority_ < n.priority_) {
+                last = stack_.back();
+                stack_.pop_back();
+                update_size(last);
+            }
+            n.left_ = last;
+            if (last != Nil) {
+                nodes_[last].parent_ = node;
+            }
+            if (!stack_.empty()) {
+                nodes_[stack_.back()].right_ = node;
+                n.parent_ = stack_.back();
+            }
+            stack_.push_back(node);
+        }
+        root_ = stack_.front();
+        while (!stack_.empty()) {
+            update_size(stack_.back());
+            stack_.pop_back();
+        }
+    }
+
+    [[nodiscard]] uint32_t size() const { return static_cast<uint32_t>(nodes_.size()); }
+
+    // Returns the position of the node in the tour
+    [[nodiscard]] uint32_t get_position(uint32_t node) const {
+        bool flipped = is_flipped(node);
+        uint32_t position = get_left_size(node, flipped);
+        for (auto x = node; nodes_[x].parent_ != Nil; x = nodes_[x].parent_) {
+            const auto parent = nodes_[x].parent_;
+            flipped ^= nodes_[x].reversed_;  // Now for the parent
+            const bool is_left = (nodes_[parent].left_ == x) != flipped;
+            if (!is_left) {
+                position += get_left_size(parent, flipped) + 1;
+            }
+        }
+        return position;
+    }
+
+    // Returns the node at the given position of the tour
+    [[nodiscard]] uint32_t get_node_at(uint32_t position) const {
+        assert(position < size());
+        bool flipped = false;
+        auto x = root_;
+        while (true) {
+            flipped ^= nodes_[x].reversed_;
+            const auto left_size = get_left_size(x, flipped);
+            if (position < left_size) {
+                x = flipped ? nodes_[x].right_ : nodes_[x].left_;
+            } else if (position == left_size) {
+                return x;
+            } else {
+                position -= left_size + 1;
+                x = flipped ? nodes_[x].left_ : nodes_[x].right_;
+            }
+        }
+    }
+
+    [[nodiscard]] uint32_t get_succ(uint32_t node) const {
+        return get_neighbor(node, true);
+    }
+
+    [[nodiscard]] uint32_t get_pred(uint32_t node) const {
+        return get_neighbor(node, false);
+    }
+
+    // Returns true if b lies on the path going from a to c (in the tour
+    // order), including the endpoints
+    [[nodiscard]] bool between(uint32_t a, uint32_t b, uint32_t c) const {
+        const auto i = get_position(a);
+        const auto j = get_position(b);
+        const auto k = get_position(c);
+        return (i <= k) ? (i <= j && j <= k) : (i <= j || j <= k);
+    }
+
+    [[nodiscard]] bool contains_edge(uint32_t a, uint32_t b) const {
+        return get_succ(a) == b || get_pred(a) == b;
+    }
+
+    /*
+     * Performs a 2-opt move which replaces edges (t1, t2) and (t3, t4) with
+     * (t1, t3) and (t2, t4). It is assumed that t2 follows t1 and t4 follows
+     * t3 in the same direction of traversal.
+     */
+    void flip(uint32_t t1, uint32_t t2, uint32_t t3, uint32_t /*t4*/) {
+        if (get_succ(t1) == t2) {
+            reverse(t2, t3);
+        } else {
+            reverse(t3, t2);
+        }
+    }
+
+    /*
+     * Reverses the path going from first to last (in the tour order). If the
+     * path wraps around the end of the tour, the remaining part is reversed
+     * instead, as the result is equivalent.
+     */
+    void reverse(uint32_t first, uint32_t last) {
+        const auto i = get_position(first);
+        const auto j = get_position(last);
+        if (i <= j) {
+            reverse_range(i, j + 1);
+        } else if (j + 1 < i) {
+            reverse_range(j + 1, i);
+        }
+    }
+
+    // Moves node v so that it is placed directly after node u
+    void relocate(uint32_t u, uint32_t v) {
+        assert(u != v);
+        uint32_t before, rest, tail, node;
+        split(root_, get_position(v), before, rest);
+        split(rest, 1, node, tail);
+        root_ = merge(before, tail);
+        nodes_[root_].parent_ = Nil;
+
+        split(root_, get_position(u) + 1, before, tail);
+        root_ = merge(merge(before, node), tail);
+        nodes_[root_].parent_ = Nil;
+    }
+
+    void get_route(std::vector<uint32_t> &route) const {
+        route.resize(size());
+        uint32_t position = 0;
+        collect(root_, false, route, position);
+    }
+
+private:
+
+    // Returns the parity of the reversal flags of the node and all of its
+    // ancestors, i.e. true if the node's children should be swapped
+    [[nodiscard]] bool is_flipped(uint32_t node) const {
+        bool flipped = false;
+        for (auto x = node; x != Nil; x = nodes_[x].parent_) {
+            flipped ^= nodes_[x].reversed_;
+        }
+        return flipped;
+    }
+
+    /*
+     * Returns the successor (if forward is true) or the predecessor of the
+     * node. Instead of finding the node at the next position, we move to the
+     * neighbor in the in-order traversal which takes O(1) expected steps,
+     * apart from computing the parity of the reversal flags.
+     */
+    [[nodiscard]] uint32_t get_neighbor(uint32_t node, bool forward) const {
+        bool flipped = is_flipped(node);
+        // The child on the forward side in the tour order
+        const auto child = (flipped == forward) ? nodes_[node].left_ : nodes_[node].right_;
+        if (child != Nil) {
+            return get_extreme(child, flipped ^ nodes_[child].reversed_, !forward);
+        }
+        // Go up until we arrive from the child on the backward side
+        for (auto x = node; nodes_[x].parent_ != Nil; x = nodes_[x].parent_) {
+            const auto parent = nodes_[x].parent_;
+            flipped ^= nodes_[x].reversed_;  // Now for the parent
+            const bool is_left = (nodes_[parent].left_ == x) != flipped;
+            if (is_left == forward) {
+                return parent;
+            }
+        }
+        // The node is the last (or the first) one, wrap around
+        return get_extreme(root_, nodes_[root_].reversed_, !forward);
+    }
+
+    // Returns the last (if last is true) or the first node in the subtree
+    [[nodiscard]] uint32_t get_extreme(uint32_t node, bool flipped, bool last) const {
+        while (true) {
+            const auto next = (flipped == last) ? nodes_[node].left_ : nodes_[node].right_;
+            if (next == Nil) {
+                return node;
+            }
+            node = next;
+            flipped ^= nodes_[node].reversed_;
+        }
+    }
+
+    [[nodiscard]] uint32_t get_size(uint32_t node) const {
+        return node != Nil ? nodes_[node].size_ : 0;
+    }
+
+    // Size of the node's left subtree in the tour order
+    [[nodiscard]] uint32_t get_left_size(uint32_t node, bool flipped) const {
+        return get_size(flipped ? nodes_[node].right_ : nodes_[node].left_);
+    }
+
+    void update_size(uint32_t node) {
+        auto &n = nodes_[node];
+        n.size_ = 1 + get_size(n.left_) + get_size(n.right_);
+    }
+
+    // Recomputes the size of the node and sets it as its children's parent
+    void update(uint32_t node) {
+        update_size(node);
+        const auto &n = nodes_[node];
+        if (n.left_ != Nil) {
+            nodes_[n.left_].parent_ = node;
+        }
+        if (n.right_ != Nil) {
+            nodes_[n.right_].parent_ = node;
+        }
+    }
+
+    // Applies the node's pending reversal to its children
+    void push(uint32_t node) {
+        auto &n = nodes_[node];
+        if (n.reversed_) {
+            std::swap(n.left_, n.right_);
+            if (n.left_ != Nil) {
+                nodes_[n.left_].reversed_ = !nodes_[n.left_].reversed_;
+            }
+            if (n.right_ != Nil) {
+                nodes_[n.right_].reversed_ = !nodes_[n.right_].reversed_;
+            }
+            n.reversed_ = false;
+        }
+    }
+
+    // Splits the tree into the first count nodes (left) and the rest (right)
+    void split(uint32_t node, uint32_t count, uint32_t &left, uint32_t &right) {
+        if (node == Nil) {
+            left = right = Nil;
+            return ;
+        }
+        push(node);
+        const auto left_size = get_size(nodes_[node].left_);
+        if (left_size < count) {
+            uint32_t tail;
+            split(nodes_[node].right_, count - left_size - 1, tail, right);
+            nodes_[node].right_ = tail;
+            left = node;
+        } else {
+            uint32_t head;
+            split(nodes_[node].left_, count, left, head);
+            nodes_[node].left_ = head;
+            right = node;
+        }
+        update(node);
+        if (left != Nil) {
+            nodes_[left].parent_ = Nil;
+        }
+        if (right != Nil) {
+            nodes_[right].parent_ = Nil;
+        }
+    }
+
+    uint32_t merge(uint32_t left, uint32_t right) {
+        if (left == Nil) {
+            return right;
+        }
+        if (right == Nil) {
+            return left;
+        }
+        if (nodes_[left].priority_ > nodes_[right].priority_) {
+            push(left);
+            nodes_[left].right_ = merge(nodes_[left].right_, right);
+            update(left);
+            return left;
+        }
+        push(right);
+        nodes_[right].left_ = merge(left, nodes_[right].left_);
+        update(right);
+        return right;
+    }
+
+    // Reverses the nodes at positions [first, last)
+    void reverse_range(uint32_t first, uint32_t last) {
+        uint32_t before, rest, middle, after;
+        split(root_, first, before, rest);
+        split(rest, last - first, middle, after);
+        nodes_[middle].reversed_ = !nodes_[middle].reversed_;
+        root_ = merge(merge(before, middle), after);
+        nodes_[root_].parent_ = Nil;
+    }
+
+    void collect(uint32_t node, bool flipped, std::vector<uint32_t> &route,
+                 uint32_t &position) const {
+        while (node != Nil) {
+            flipped ^= nodes_[node].reversed_;
+            collect(flipped ? nodes_[node].right_ : nodes_[node].left_, flipped, route, position);
+            route[position++] = node;
+            node = flipped ? nodes_[node].left_ : nodes_[node].right_;
+        }
+    }
+};
@@ -0,0 +1,351 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+
+/**
+ * Implementation of the two-level doubly-linked list representation of a tour
+ * as described in:
+ *
+ * Fredman, Michael L., et al. "Data structures for traveling salesmen."
+ * Journal of Algorithms 18.3 (1995): 432-479.
+ *
+ * The tour is split into segments of about sqrt(n) nodes. Each segment has a
+ * reversal bit, so that reversing a part of the tour (e.g. in a 2-opt move)
+ * requires splitting at most two segments and reversing the order of the
+ * segments in between. All of the get_succ, get_pred, between and flip
+ * operations take O(sqrt(n)) time, compared to O(n) for a flip in the array
+ * representation.
+ */
+class TwoLevelList {
+public:
+    struct Node {
+        uint32_t prev_ = 0;     // Neighbors in the internal order of the
+        uint32_t next_ = 0;     // segment, valid only inside the segment
+        uint32_t segment_ = 0;
+        int32_t  id_ = 0;       // Sequence number, increases along next_
+    };
+
+    struct Segment {
+        uint32_t first_ = 0;    // First and last node in the internal order
+        uint32_t last_ = 0;
+        uint32_t prev_ = 0;     // Neighboring segments in the tour order
+        uint32_t next_ = 0;
+        uint32_t rank_ = 0;     // Position of the segment in the tour order
+        bool reversed_ = false; // Is the internal order opposite to the tour order?
+    };
+
+    std::vector<Node> nodes_;
+    std::vector<Segment> segments_;
+    uint32_t head_segment_ = 0;  // The segment with rank 0
+    // Segments are only split (never merged), so the whole list is rebuilt
+    // if the number of segments becomes too large
+    uint32_t max_segments_ = 0;
+    std::vector<uint32_t> buffer_;
+
+    TwoLevelList() = default;
+
+    explicit TwoLevelList(const std::vector<uint32_t> &route) {
+        init(route);
+    }
+
+    void init(const std::vector<uint32_t> &route) {
+        const auto n = static_cast<uint32_t>(route.size());
+        assert(n > 0);
+
+        const auto group_size = std::max(8u, static_cast<uint32_t>(std::sqrt(n)));
+        const auto groups = (n + group_size - 1) / group_size;
+        max_segments_ = 2 * groups + 8;
+
+        nodes_.resize(n);
+        segments_.clear();
+        segments_.reserve(max_segments_ + 2);
+
+        for (uint32_t g = 0; g < groups; ++g) {
+            const auto start = g * group_size;
+            const auto end = std::min(n, start + group_size);
+
+            Segment seg;
+            seg.first_ = route[start];
+            seg.last_ = route[end - 1];
+            seg.prev_ = (g > 0) ? g - 1 : groups - 1;
+            seg.next_ = (g + 1 < groups) ? g + 1 : 0;
+            seg.rank_ = g;
+            segments_.push_back(seg);
+
+            for (auto i = start; i < end; ++i) {
+                auto &node = nodes_[route[i]];
+                node.prev_ = (i > start) ? route[i - 1] : route[i];
+                node.next_ = (i + 1 < end) ? route[i + 1] : route[i];
+                node.segment_ = g;
+                node.id_ = static_cast<int32_t>(i - start);
+            }
+        }
+        head_segment_ = 0;
+    }
+
+    [[nodiscard]] uint32_t size() const { return static_cast<uint32_t>(nodes_.size()); }
+
+    [[nodiscard]] uint32_t get_succ(uint32_t node) const {
+        const auto &n = nodes_[node];
+        const auto &seg = segments_[n.segment_];
+        if (!seg.reversed_) {
+            return (node != seg.last_) ? n.next_ : get_head(seg.next_);
+        }
+        return (node != seg.first_) ? n.prev_ : get_head(seg.next_);
+    }
+
+    [[nodiscard]] uint32_t get_pred(uint32_t node) const {
+        const auto &n = nodes_[node];
+        const auto &seg = segments_[n.segment_];
+        if (!seg.reversed_) {
+            return (node != seg.first_) ? n.prev_ : get_tail(seg.prev_);
+        }
+        return (node != seg.last_) ? n.next_ : get_tail(seg.prev_);
+    }
+
+    // Returns true if b lies on the path going from a to c (in the tour
+    // order), including the endpoints
+    [[nodiscard]] bool between(uint32_t a, uint32_t b, uint32_t c) const {
+        const auto ka = get_key(a);
+        const auto kb = get_key(b);
+        const auto kc = get_key(c);
+        return (ka <= kc) ? (ka <= kb && kb <= kc) : (ka <= kb || kb <= kc);
+    }
+
+    [[nodiscard]] bool contains_edge(uint32_t a, uint32_t b) const {
+        return get_succ(a) == b || get_pred(a) == b;
+    }
+
+    /*
+     * Performs a 2-opt move which replaces edges (t1, t2) and (t3, t4) with
+     * (t1, t3) and (t2, t4). It is assumed that t2 follows t1 and t4 follows
+     * t3 in the same direction of traversal.
+     */
+    void flip(uint32_t t1, uint32_t t2, uint32_t t3, uint32_t /*t4*/) {
+        if (get_succ(t1) == t2) {
+            reverse(t2, t3);
+        } else {
+            reverse(t3, t2);
+        }
+    }
+
+    /*
+     * Reverses the path going from first to last (in the tour order). The
+     * remaining part of the tour may be reversed instead, as the result is
+     * equivalent.
+     */
+    void reverse(uint32_t first, uint32_t last) {
+        if (first == last || get_succ(last) == first) {
+            return ;
+        }
+        if (nodes_[first].segment_ == nodes_[last].segment_) {
+            if (get_oriented_id(first) <= get_oriented_id(last)) {
+                reverse_inside_segment(first, last);
+            } else {  // The path goes around the whole tour
+                reverse_inside_segment(get_succ(last), get_pred(first));
+            }
+            return ;
+        }
+        if (segments_.size() + 2 > max_segments_) {
+            rebuild();
+        }
+        split_before(first);
+        split_before(get_succ(last));
+
+        auto first_seg = nodes_[first].segment_;
+        auto last_seg = nodes_[last].segment_;
+        if (segments_[first_seg].rank_ > segments_[last_seg].rank_) {
+            // The range contains the last and the first segment, so we
+            // reverse the remaining segments instead
+            const auto tmp = first_seg;
+            first_seg = segments_[last_seg].next_;
+            last_seg = segments_[tmp].prev_;
+        }
+        reverse_segments(first_seg, last_seg);
+    }
+
+    // Writes the nodes in the tour order to the route, starting from the
+    // first node of the head segment
+    void get_route(std::vector<uint32_t> &route) const {
+        route.resize(nodes_.size());
+        auto node = get_head(head_segment_);
+        for (auto &el : route) {
+            el = node;
+            node = get_succ(node);
+        }
+    }
+
+private:
+
+    [[nodiscard]] uint32_t get_head(uint32_t seg_id) const {
+        const auto &seg = segments_[seg_id];
+        return seg.reversed_ ? seg.last_ : seg.first_;
+    }
+
+    [[nodiscard]] uint32_t get_tail(uint32_t seg_id) const {
+        const auto &seg = segments_[seg_id];
+        return seg.reversed_ ? seg.first_ : seg.last_;
+    }
+
+    [[nodiscard]] int32_t get_oriented_id(uint32_t node) const {
+        const auto &n = nodes_[node];
+        return segments_[n.segment_].reversed_ ? -n.id_ : n.id_;
+    }
+
+    // Position of the node in the tour order, relative to the head segment
+    [[nodiscard]] int64_t get_key(uint32_t node) const {
+        const auto rank = segments_[nodes_[node].segment_].rank_;
+        return static_cast<int64_t>(rank) * (INT64_C(1) << 32) + get_oriented_id(node);
+    }
+
+    void rebuild() {
+        get_route(buffer_);
+        init(buffer_);
+    }
+
+    void update_ranks() {
+        auto seg_id = head_segment_;
+        uint32_t rank = 0;
+        do {
+            segments_[seg_id].rank_ = rank++;
+            seg_id = segments_[seg_id].next_;
+        } while (seg_id != head_segment_);
+    }
+
+    /*
+     * Reverses the path from first to last which is contained in a single
+     * segment. This takes time proportional to the length of the path.
+     */
+    void reverse_inside_segment(uint32_t first, uint32_t last) {
+        auto &seg = segments_[nodes_[first].segment_];
+        // The path in the internal order of the segment is [u, v]
+        const auto u = seg.reversed_ ? last : first;
+        const auto v = seg.reversed_ ? first : last;
+        const bool has_pred = (u != seg.first_);
+        const bool has_succ = (v != seg.last_);
+        const auto v_succ = nodes_[v].next_;
+
+        auto id = nodes_[u].id_;
+        auto prev = has_pred ? nodes_[u].prev_ : v;
+        auto node = v;
+        while (true) {
+            auto &n = nodes_[node];
+            const auto next = n.prev_;  // Moving backwards from v to u
+            n.prev_ = prev;
+            if (prev != node) {
+                nodes_[prev].next_ = node;
+            }
+            n.id_ = id++;
+            if (node == u) {
+                break ;
+            }
+            prev = node;
+            node = next;
+        }
+        nodes_[u].next_ = has_succ ? v_succ : u;
+        if (has_succ) {
+            nodes_[v_succ].prev_ = u;
+        }
+        if (!has_pred) {
+            seg.first_ = v;
+        }
+        if (!has_succ) {
+            seg.last_ = u;
+        }
+    }
+
+    /*
+     * Splits the segment containing the node so that the node becomes the
+     * first one (in the tour order) in its segment. The smaller of the two
+     * parts is moved to a new segment.
+     */
+    void split_before(uint32_t node) {
+        const auto seg_id = nodes_[node].segment_;
+        if (get_head(seg_id) == node) {
+            return ;
+        }
+        const auto reversed = segments_[seg_id].reversed_;
+        // The segment is split between u and v, where u precedes v in the
+        // internal order
+        const auto u = reversed ? node : nodes_[node].prev_;
+        const auto v = reversed ? nodes_[node].next_ : node;
+
+        auto &seg = segments_[seg_id];
+        const auto left_size = nodes_[u].id_ - nodes_[seg.first_].id_ + 1;
+        const auto right_size = nodes_[seg.last_].id_ - nodes_[v].id_ + 1;
+        const bool move_left = left_size <= right_size;
+
+        Segment new_seg;
+        new_seg.reversed_ = reversed;
+        if (move_left) {
+            new_seg.first_ = seg.first_;
+            new_seg.last_ = u;
+            seg.first_ = v;
+        } else {
+            new_seg.first_ = v;
+            new_seg.last_ = seg.last_;
+            seg.last_ = u;
+        }
+        const auto new_seg_id = static_cast<uint32_t>(segments_.size());
+        for (auto x = new_seg.first_; ; x = nodes_[x].next_) {
+            nodes_[x].segment_ = new_seg_id;
+            if (x == new_seg.last_) {
+                break ;
+            }
+        }
+        // The left part precedes the right part in the tour order, unless
+        // the segment is reversed
+        const bool insert_before = (move_left != reversed);
+        if (insert_before) {
+            new_seg.next_ = seg_id;
+            new_seg.prev_ = seg.prev_;
+        } else {
+            new_seg.prev_ = seg_id;
+            new_seg.next_ = seg.next_;
+        }
+        segments_.push_back(new_seg);  // seg reference is invalid from now
+
+        segments_[new_seg.prev_].next_ = new_seg_id;
+        segments_[new_seg.next_].prev_ = new_seg_id;
+
+        update_ranks();
+    }
+
+    /*
+     * Reverses the order of the segments going from first_seg to last_seg,
+     * which have increasing ranks. The remaining segments are not changed.
+     */
+    void reverse_segments(uint32_t first_seg, uint32_t last_seg) {
+        buffer_.clear();
+        for (auto s = first_seg; ; s = segments_[s].next_) {
+            buffer_.push_back(s);
+            if (s == last_seg) {
+                break ;
+            }
+        }
+        const auto before = segments_[first_seg].prev_;
+        const auto after = segments_[last_seg].next_;
+        auto rank = segments_[first_seg].rank_;
+
+        auto prev = before;
+        for (auto it = buffer_.rbegin(); it != buffer_.rend(); ++it) {
+            auto &seg = segments_[*it];
+            seg.reversed_ = !seg.reversed_;
+            seg.rank_ = rank++;
+            seg.prev_ = prev;
+            segments_[prev].next_ = *it;
+            prev = *it;
+        }
+        segments_[prev].next_ = after;
+        segments_[after].prev_ = prev;
+
+        if (head_segment_ == first_seg) {  // Rank 0 was given to last_seg
+            head_segment_ = last_seg;
+        }
+    }
+};